@@ -1,5 +1,6 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/bootinfo.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -27,19 +28,39 @@
  *    and a stack so C code then run, then calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *
+ * TWO-STAGE BOOT
+ *  * When built with STAGE2_ADDR/STAGE2_NSECT defined (obj/boot/boot1),
+ *    bootmain() instead reads the STAGE2_NSECT sectors following this
+ *    one into STAGE2_ADDR and jumps there.  That second stage
+ *    (boot2.S and main2.c) has room to load the kernel, which then
+ *    starts at sector 1 + STAGE2_NSECT, with bus-master DMA.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one ATA command can transfer
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define BOOTINFO	((struct Bootinfo *) BOOTINFO_PADDR)
 
-void readsect(void*, uint32_t);
-void readseg(uint32_t, uint32_t, uint32_t);
+static void readsect(void*, uint32_t, uint32_t);
+static void readseg(uint32_t, uint32_t, uint32_t);
 
 void
 bootmain(void)
 {
 	struct Proghdr *ph, *eph;
-
+	uint8_t *p, *end;
+
+	// start a fresh boot info record
+	for (p = (uint8_t *) BOOTINFO; p < (uint8_t *) (BOOTINFO + 1); p++)
+		*p = 0;
+	BOOTINFO->bi_magic = BOOTINFO_MAGIC;
+
+#ifdef STAGE2_NSECT
+	// read the second stage and let it do the real work
+	readseg(STAGE2_ADDR, STAGE2_NSECT*SECTSIZE, 0);
+	((void (*)(void)) STAGE2_ADDR)();
+#else
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
 
@@ -50,14 +71,21 @@ bootmain(void)
 	// load each program segment (ignores ph flags)
 	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
+	for (; ph < eph; ph++) {
 		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+		// as the physical address).  Only the first p_filesz
+		// bytes are on disk; the rest (the BSS) is zero-filled
+		// here rather than wasting disk reads on it.
+		readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+		end = (uint8_t *) ph->p_pa + ph->p_memsz;
+		for (p = (uint8_t *) ph->p_pa + ph->p_filesz; p < end; p++)
+			*p = 0;
+	}
 
 	// call the entry point from the ELF header
 	// note: does not return!
 	((void (*)(void)) (ELFHDR->e_entry))();
+#endif
 
 bad:
 	outw(0x8A00, 0x8A00);
@@ -69,10 +97,15 @@ bad:
 // Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
 // Might copy more than asked
 // 把距离内核offset位置的count个比特复制到物理地址pa处
-void
+static void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, nsect;
+
+	// timestamp the start of each read; the first one is
+	// effectively bootmain's entry (see inc/bootinfo.h)
+	if (BOOTINFO->bi_ntsc < BT_NLOADER)
+		BOOTINFO->bi_tsc[BOOTINFO->bi_ntsc++] = read_tsc();
 
 	end_pa = pa + count;
 
@@ -82,17 +115,20 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
+	// Read up to MAXSECTS sectors per command.  We may write more
+	// to memory than asked (up to the end of the last sector), but
+	// it doesn't matter -- we load in increasing order.
 	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsect((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
 	}
 }
 
@@ -105,24 +141,35 @@ waitdisk(void)
 }
 
 
-// 从offset的偏移位置读一个扇区到物理地址dst
-void
-readsect(void *dst, uint32_t offset)
+// 从offset的偏移位置读nsect个扇区到物理地址dst
+// Read 'nsect' (1..MAXSECTS) consecutive sectors starting at LBA 'offset'
+// into 'dst' with a single read command.
+static void
+readsect(void *dst, uint32_t offset, uint32_t nsect)
 {
+	int port;
+
+	BOOTINFO->bi_nsect += nsect;
+	BOOTINFO->bi_ncmd++;
+
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
-	outb(0x1F3, offset);
-	outb(0x1F4, offset >> 8);
-	outb(0x1F5, offset >> 16);
-	outb(0x1F6, (offset >> 24) | 0xE0);
+	outb(0x1F2, nsect);	// count (0 means 256)
+	// LBA bits 0-23 go to 0x1F3..0x1F5, and bits 24-27 go to 0x1F6
+	// along with 0xE0 (LBA mode, master drive)
+	for (port = 0x1F3, offset |= 0xE0000000; offset; offset >>= 8)
+		outb(port++, offset);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
+	// the drive raises DRQ once per sector
+	for (; nsect > 0; nsect--) {
+		// wait for disk to be ready
+		waitdisk();
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+		// read a sector
+		insl(0x1F0, dst, SECTSIZE/4);
+		dst += SECTSIZE;
+	}
 }
 
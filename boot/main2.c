@@ -0,0 +1,409 @@
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/bootinfo.h>
+#include <inc/zimage.h>
+
+/**********************************************************************
+ * Second-stage boot loader.
+ *
+ * The 512-byte boot sector only has room for polled PIO, which costs a
+ * status poll and a 512-byte 'insl' per sector.  This stage is loaded
+ * by the boot sector (see main.c) and loads the kernel using PCI
+ * bus-master IDE DMA instead: for each run of up to 256 sectors we
+ * point the controller at a PRD (physical region descriptor) table
+ * describing the destination memory, issue READ DMA, and wait for the
+ * controller to say it is done.
+ *
+ * DISK LAYOUT
+ *  * sector 0: boot sector (obj/boot/boot1)
+ *  * sectors 1 .. STAGE2_NSECT: this loader (obj/boot/boot2)
+ *  * sector 1 + STAGE2_NSECT onward: the kernel ELF image
+ *
+ * If no bus-master IDE controller turns up on PCI bus 0, or a DMA
+ * transfer fails, we fall back to PIO, so this loader always boots.
+ *
+ * COMPRESSED KERNELS
+ *  * Built with -DZIMAGE (obj/boot/boot2z), this loader expects the
+ *    kernel as a compressed image (see inc/zimage.h) instead of an ELF
+ *    file.  Each segment's compressed blocks are streamed into
+ *    ZSCRATCH and each block is decoded into place as soon as it is
+ *    all in memory, so far fewer sectors come off the disk.
+ **********************************************************************/
+
+#define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one ATA command can transfer
+#define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define ZIMGHDR		((struct Zimghdr *) 0x10000)
+#define ZSCRATCH	((uint8_t *) ZSCRATCH_PADDR)
+#define BOOTINFO	((struct Bootinfo *) BOOTINFO_PADDR)
+#define KERNSECT	(1 + STAGE2_NSECT)	// first sector of the kernel
+
+// ATA commands
+#define ATA_READ	0x20	// read sectors, PIO
+#define ATA_READ_DMA	0xC8	// read sectors, DMA
+
+// PCI configuration space access, mechanism #1
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+#define PCI_COMMAND	0x04	// command register offset
+#define   PCI_COMMAND_IO	0x1	//   Enable I/O space
+#define   PCI_COMMAND_MASTER	0x4	//   Enable bus mastering
+#define PCI_CLASS	0x08	// class/subclass/prog-if/revision offset
+#define PCI_BAR4	0x20	// bus-master IDE I/O base
+#define PCI_CLASS_IDE	0x0101	// mass storage class, IDE subclass
+
+// Bus-master IDE registers for the primary channel, relative to BAR4
+#define BMI_CMD		0	// Command register
+#define   BMI_CMD_START	0x01	//   Start/stop bus master
+#define   BMI_CMD_READ	0x08	//   Transfer device -> memory
+#define BMI_STATUS	2	// Status register
+#define   BMI_STATUS_ERR	0x02	//   Error (write 1 to clear)
+#define   BMI_STATUS_INTR	0x04	//   Interrupt (write 1 to clear)
+#define BMI_PRDT	4	// PRD table physical address
+
+// A physical region descriptor.  A region may not cross a 64KB
+// boundary; a byte count of 0 means 64KB.
+struct Prd {
+	uint32_t prd_addr;
+	uint16_t prd_count;
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000	// Last descriptor in the table
+
+// A 256-sector run spans at most three 64KB regions.  The table must
+// not cross a 64KB boundary itself, which the alignment guarantees.
+#define NPRD		4
+
+static struct Prd prdt[NPRD] __attribute__((__aligned__(sizeof(struct Prd) * NPRD)));
+static uint32_t bmbase;		// Bus-master I/O base, or 0 to use PIO
+
+static void readsect(void*, uint32_t, uint32_t);
+static void readseg(uint32_t, uint32_t, uint32_t);
+static void dma_init(void);
+static int zload(struct Zseg *);
+static void stamp(void);
+
+void
+bootmain2(void)
+{
+	struct Proghdr *ph, *eph;
+	struct Zseg *zs, *ezs;
+	uint8_t *p, *end;
+
+	dma_init();
+
+#ifdef ZIMAGE
+	// read the image header
+	readseg((uint32_t) ZIMGHDR, SECTSIZE, 0);
+
+	if (ZIMGHDR->z_magic != ZIMG_MAGIC || ZIMGHDR->z_nseg > ZIMG_MAXSEG)
+		goto bad;
+	BOOTINFO->bi_flags |= BI_LZ4;
+
+	zs = ZIMGHDR->z_seg;
+	ezs = zs + ZIMGHDR->z_nseg;
+	for (; zs < ezs; zs++) {
+		if (zload(zs) < 0)
+			goto bad;
+		end = (uint8_t *) zs->zs_pa + zs->zs_memsz;
+		for (p = (uint8_t *) zs->zs_pa + zs->zs_filesz; p < end; p++)
+			*p = 0;
+	}
+
+	((void (*)(void)) (ZIMGHDR->z_entry))();
+#else
+	// read 1st page off disk
+	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
+
+	// is this a valid ELF?
+	if (ELFHDR->e_magic != ELF_MAGIC)
+		goto bad;
+
+	// load each program segment (ignores ph flags)
+	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	eph = ph + ELFHDR->e_phnum;
+	for (; ph < eph; ph++) {
+		readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+		end = (uint8_t *) ph->p_pa + ph->p_memsz;
+		for (p = (uint8_t *) ph->p_pa + ph->p_filesz; p < end; p++)
+			*p = 0;
+	}
+
+	// call the entry point from the ELF header
+	// note: does not return!
+	((void (*)(void)) (ELFHDR->e_entry))();
+#endif
+
+bad:
+	outw(0x8A00, 0x8A00);
+	outw(0x8A00, 0x8E00);
+	while (1)
+		/* do nothing */;
+}
+
+static uint32_t
+pci_conf_read(uint32_t dev, uint32_t off)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | off);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t dev, uint32_t off, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | off);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Find the first IDE controller on PCI bus 0 with a bus-master I/O
+// BAR, turn on bus mastering, and remember where its registers are.
+static void
+dma_init(void)
+{
+	uint32_t dev, bar;
+
+	bmbase = 0;
+	// dev is the device/function part of a configuration address
+	for (dev = 0; dev < (32 << 11); dev += (1 << 8)) {
+		if (pci_conf_read(dev, 0) == 0xFFFFFFFF)
+			continue;
+		if ((pci_conf_read(dev, PCI_CLASS) >> 16) != PCI_CLASS_IDE)
+			continue;
+		bar = pci_conf_read(dev, PCI_BAR4);
+		if (!(bar & 1) || !(bar & ~3))
+			continue;	// not an I/O BAR, or not assigned
+		pci_conf_write(dev, PCI_COMMAND,
+			       pci_conf_read(dev, PCI_COMMAND)
+			       | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+		bmbase = bar & ~3;
+		BOOTINFO->bi_flags |= BI_DMA;
+		return;
+	}
+}
+
+// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Might copy more than asked.
+static void
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
+{
+	uint32_t end_pa, nsect;
+
+	stamp();
+	end_pa = pa + count;
+
+	// round down to sector boundary
+	pa &= ~(SECTSIZE - 1);
+
+	// translate from bytes to sectors
+	offset = (offset / SECTSIZE) + KERNSECT;
+
+	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
+		readsect((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
+	}
+}
+
+// Timestamp the start of a read (see inc/bootinfo.h)
+static void
+stamp(void)
+{
+	if (BOOTINFO->bi_ntsc < BT_NLOADER)
+		BOOTINFO->bi_tsc[BOOTINFO->bi_ntsc++] = read_tsc();
+}
+
+static void
+waitdisk(void)
+{
+	// wait for disk ready
+	while ((inb(0x1F7) & 0xC0) != 0x40)
+		/* do nothing */;
+}
+
+static void
+ata_cmd(uint32_t offset, uint32_t nsect, int cmd)
+{
+	// wait for disk to be ready
+	waitdisk();
+
+	outb(0x1F2, nsect);	// count (0 means 256)
+	outb(0x1F3, offset);
+	outb(0x1F4, offset >> 8);
+	outb(0x1F5, offset >> 16);
+	outb(0x1F6, (offset >> 24) | 0xE0);
+	outb(0x1F7, cmd);
+}
+
+// Read 'nsect' sectors at 'offset' into 'dst' using bus-master DMA.
+// Returns 0 on success, -1 if the controller or drive reported an error.
+static int
+readsect_dma(void *dst, uint32_t offset, uint32_t nsect)
+{
+	uint32_t pa, end, next;
+	uint8_t status;
+	int i;
+
+	// describe [dst, dst + nsect*SECTSIZE) without crossing 64KB
+	pa = (uint32_t) dst;
+	end = pa + nsect * SECTSIZE;
+	for (i = 0; pa < end; i++) {
+		next = (pa + 0x10000) & ~0xFFFF;
+		if (next > end)
+			next = end;
+		prdt[i].prd_addr = pa;
+		prdt[i].prd_count = next - pa;
+		prdt[i].prd_flags = 0;
+		pa = next;
+	}
+	prdt[i - 1].prd_flags = PRD_EOT;
+
+	outl(bmbase + BMI_PRDT, (uint32_t) prdt);
+	outb(bmbase + BMI_CMD, BMI_CMD_READ);
+	outb(bmbase + BMI_STATUS, inb(bmbase + BMI_STATUS)
+	     | BMI_STATUS_ERR | BMI_STATUS_INTR);
+
+	ata_cmd(offset, nsect, ATA_READ_DMA);
+	outb(bmbase + BMI_CMD, BMI_CMD_READ | BMI_CMD_START);
+
+	// the controller raises INTR once the drive has finished
+	while (!((status = inb(bmbase + BMI_STATUS))
+		 & (BMI_STATUS_ERR | BMI_STATUS_INTR)))
+		/* do nothing */;
+	outb(bmbase + BMI_CMD, BMI_CMD_READ);
+
+	// reading the drive status also acknowledges its interrupt
+	if ((status & BMI_STATUS_ERR) || (inb(0x1F7) & 0x01))
+		return -1;
+	return 0;
+}
+
+// Read 'nsect' (1..MAXSECTS) consecutive sectors starting at LBA 'offset'
+// into 'dst', by DMA if we can and PIO if we can't.
+static void
+readsect(void *dst, uint32_t offset, uint32_t nsect)
+{
+	BOOTINFO->bi_nsect += nsect;
+	BOOTINFO->bi_ncmd++;
+
+	if (bmbase) {
+		if (readsect_dma(dst, offset, nsect) == 0)
+			return;
+		// give up on DMA for good and redo this run with PIO
+		bmbase = 0;
+		BOOTINFO->bi_flags &= ~BI_DMA;
+		BOOTINFO->bi_ncmd++;
+	}
+
+	ata_cmd(offset, nsect, ATA_READ);
+
+	// the drive raises DRQ once per sector
+	for (; nsect > 0; nsect--) {
+		// wait for disk to be ready
+		waitdisk();
+
+		// read a sector
+		insl(0x1F0, dst, SECTSIZE/4);
+		dst += SECTSIZE;
+	}
+}
+
+#ifdef ZIMAGE
+// Decode the LZ4 block [src, send) into dst.
+// Returns the end of the decoded data.
+static uint8_t *
+lz4_decode(uint8_t *dst, const uint8_t *src, const uint8_t *send)
+{
+	const uint8_t *ref;
+	uint32_t token, len, b;
+
+	while (1) {
+		token = *src++;
+
+		// literal run; a length nibble of 15 continues in more bytes
+		len = token >> 4;
+		if (len == 15)
+			do {
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		for (; len > 0; len--)
+			*dst++ = *src++;
+
+		// the last sequence in a block is literals only
+		if (src >= send)
+			return dst;
+
+		// match: copy from earlier output, possibly overlapping
+		ref = dst - (src[0] | (src[1] << 8));
+		src += 2;
+		len = token & 15;
+		if (len == 15)
+			do {
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		for (len += 4; len > 0; len--)
+			*dst++ = *ref++;
+	}
+}
+
+// Read more of a segment's sectors into ZSCRATCH, at *next from
+// sector *sect, until everything before 'want' (<= zend) is there.
+static void
+zfill(uint8_t **next, uint32_t *sect, uint8_t *want, uint8_t *zend)
+{
+	uint32_t nsect;
+
+	while (*next < want) {
+		nsect = (zend - *next + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
+		readsect(*next, *sect, nsect);
+		*next += nsect * SECTSIZE;
+		*sect += nsect;
+	}
+}
+
+// Load one segment of a compressed image.  The segment's blocks are
+// read into ZSCRATCH up to MAXSECTS sectors at a time, and every block
+// that has completely arrived is decoded before reading any more.
+// Returns -1, having read nothing past the I/O hole, if the segment
+// does not fit in ZSCRATCH or a block runs past its end.
+static int
+zload(struct Zseg *zs)
+{
+	uint8_t *zp, *zend, *next, *dst;
+	uint32_t sect, size;
+
+	stamp();
+
+	// ZSCRATCH holds the segment's sectors, so its first block lands
+	// at the same offset within a sector as it has in the image.
+	// mkzimage keeps segments small enough, but a bad image might not.
+	if (!ZSEG_FITS(zs))
+		return -1;
+	next = ZSCRATCH;
+	sect = zs->zs_offset / SECTSIZE + KERNSECT;
+	zp = ZSCRATCH + zs->zs_offset % SECTSIZE;
+	zend = zp + zs->zs_size;
+	dst = (uint8_t *) zs->zs_pa;
+
+	while (zp < zend) {
+		// make sure the size word, and then the whole block, are here
+		if (zend - zp < 4)
+			return -1;
+		zfill(&next, &sect, zp + 4, zend);
+		size = *(uint32_t *) zp;
+		if (size > (uint32_t) (zend - zp) - 4)
+			return -1;
+		zfill(&next, &sect, zp + 4 + size, zend);
+
+		dst = lz4_decode(dst, zp + 4, zp + 4 + size);
+		zp += 4 + size;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Build a compressed kernel image (see inc/zimage.h) from the kernel ELF.
+ *
+ * This is a host program: it runs at build time, not in JOS.
+ *
+ *	mkzimage kernel zimage
+ *
+ * Each loadable segment's file contents are cut into ZBLKSIZE blocks
+ * and each block is compressed with a small greedy LZ4 block encoder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Use the host's integer types instead of JOS's
+#define JOS_INC_TYPES_H
+#include <inc/elf.h>
+#include <inc/zimage.h>
+
+#define SECTSIZE	512
+
+#define MINMATCH	4
+#define LASTLITERALS	5	// the last 5 bytes are always literals
+#define MFLIMIT		12	// no match may start in the last 12 bytes
+#define HASHLOG		14
+
+static uint8_t *
+put_len(uint8_t *op, uint32_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *
+put_seq(uint8_t *op, const uint8_t *lit, uint32_t nlit,
+	uint32_t off, uint32_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = (nlit >= 15 ? 15 : nlit) << 4;
+	if (nlit >= 15)
+		op = put_len(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen == 0)
+		return op;
+
+	*op++ = off;
+	*op++ = off >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen >= 15 ? 15 : mlen;
+	if (mlen >= 15)
+		op = put_len(op, mlen - 15);
+	return op;
+}
+
+static uint32_t
+hash4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+// Compress src[0, n) (n <= ZBLKSIZE) as one LZ4 block into dst, which
+// must have room for the worst case.  Returns the compressed size.
+static uint32_t
+lz4_block(uint8_t *dst, const uint8_t *src, uint32_t n)
+{
+	static uint32_t table[1 << HASHLOG];
+	const uint8_t *ip = src, *anchor = src, *ref;
+	const uint8_t *mflimit = src + n - MFLIMIT;
+	const uint8_t *matchlimit = src + n - LASTLITERALS;
+	uint8_t *op = dst;
+	uint32_t h, mlen;
+
+	memset(table, 0xFF, sizeof(table));
+	if (n < MFLIMIT + 1)
+		goto last;
+
+	while (ip < mflimit) {
+		h = hash4(ip);
+		ref = table[h] == 0xFFFFFFFF ? NULL : src + table[h];
+		table[h] = ip - src;
+		if (!ref || memcmp(ref, ip, MINMATCH) != 0) {
+			ip++;
+			continue;
+		}
+
+		for (mlen = MINMATCH;
+		     ip + mlen < matchlimit && ref[mlen] == ip[mlen];
+		     mlen++)
+			/* do nothing */;
+		op = put_seq(op, anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+
+last:
+	return put_seq(op, anchor, src + n - anchor, 0, 0) - dst;
+}
+
+static void *
+xmalloc(size_t n)
+{
+	void *p = malloc(n);
+
+	if (!p) {
+		fprintf(stderr, "mkzimage: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *in, *out;
+	uint8_t *elf, *blk, *zdata;
+	long elfsize;
+	struct Elf *eh;
+	struct Proghdr *ph;
+	struct Zimghdr zh;
+	struct Zseg *zs;
+	uint32_t i, off, n, zn, zoff, rawsz = 0;
+	char hdr[SECTSIZE];
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: mkzimage kernel zimage\n");
+		return 1;
+	}
+
+	if ((in = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(in, 0, SEEK_END);
+	elfsize = ftell(in);
+	rewind(in);
+	elf = xmalloc(elfsize);
+	if (fread(elf, 1, elfsize, in) != elfsize) {
+		perror(argv[1]);
+		return 1;
+	}
+	fclose(in);
+
+	eh = (struct Elf *) elf;
+	if (eh->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		return 1;
+	}
+
+	memset(&zh, 0, sizeof(zh));
+	zh.z_magic = ZIMG_MAGIC;
+	zh.z_entry = eh->e_entry;
+
+	if ((out = fopen(argv[2], "wb")) == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+	zoff = SECTSIZE;
+	fseek(out, zoff, SEEK_SET);
+
+	// LZ4's worst case expansion is well under 1/128 plus a little
+	blk = xmalloc(ZBLKSIZE + ZBLKSIZE / 128 + 16);
+	ph = (struct Proghdr *) (elf + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		if (zh.z_nseg == ZIMG_MAXSEG) {
+			fprintf(stderr, "%s: too many segments\n", argv[1]);
+			return 1;
+		}
+		zs = &zh.z_seg[zh.z_nseg++];
+		zs->zs_pa = ph->p_pa;
+		zs->zs_filesz = ph->p_filesz;
+		zs->zs_memsz = ph->p_memsz;
+		zs->zs_offset = zoff;
+
+		zdata = elf + ph->p_offset;
+		for (off = 0; off < ph->p_filesz; off += n) {
+			n = ph->p_filesz - off;
+			if (n > ZBLKSIZE)
+				n = ZBLKSIZE;
+			zn = lz4_block(blk, zdata + off, n);
+			fwrite(&zn, sizeof(zn), 1, out);
+			fwrite(blk, 1, zn, out);
+			zoff += sizeof(zn) + zn;
+		}
+		zs->zs_size = zoff - zs->zs_offset;
+		rawsz += ph->p_filesz;
+
+		if (!ZSEG_FITS(zs)) {
+			fprintf(stderr, "%s: segment %u compresses to %u bytes,"
+				" more than the loader can stage\n",
+				argv[1], i, zs->zs_size);
+			return 1;
+		}
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, &zh, sizeof(zh));
+	rewind(out);
+	fwrite(hdr, 1, sizeof(hdr), out);
+	if (fclose(out) != 0) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	fprintf(stderr, "%s: %u -> %u bytes of segment data (%u%%),"
+		" %ld -> %u sectors\n", argv[2], rawsz, zoff - SECTSIZE,
+		rawsz ? (zoff - SECTSIZE) * 100 / rawsz : 0,
+		(elfsize + SECTSIZE - 1) / SECTSIZE,
+		(zoff + SECTSIZE - 1) / SECTSIZE);
+	return 0;
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/perl
+
+# Pad a boot loader stage out to exactly $ARGV[1] sectors.
+
+open(BB, $ARGV[0]) || die "open $ARGV[0]: $!";
+
+binmode BB;
+my $buf;
+my $max = $ARGV[1] * 512;
+read(BB, $buf, $max + 1);
+$n = length($buf);
+
+if($n > $max){
+	print STDERR "$ARGV[0] too large: $n bytes (max $max)\n";
+	exit 1;
+}
+
+print STDERR "$ARGV[0] is $n bytes (max $max)\n";
+
+$buf .= "\0" x ($max-$n);
+
+open(BB, ">$ARGV[0]") || die "open >$ARGV[0]: $!";
+binmode BB;
+print BB $buf;
+close BB;
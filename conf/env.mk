@@ -14,6 +14,16 @@ V = @
 #
 # GCCPREFIX=''
 
+# Uncomment the following line to compile the kernel's trace points
+# (see kern/trace.h) out of the kernel.
+#
+# TRACE=0
+
+# Uncomment the following line to build in the kernel's debug messages
+# (kdebug in kern/log.h), or set it to WARN or NONE for a quieter kernel.
+#
+# LOG_LEVEL=DEBUG
+
 # If the makefile cannot find your QEMU binary, uncomment the
 # following line and set it to the full path to QEMU.
 #
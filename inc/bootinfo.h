@@ -0,0 +1,59 @@
+#ifndef JOS_INC_BOOTINFO_H
+#define JOS_INC_BOOTINFO_H
+
+#ifndef __ASSEMBLER__
+#include <inc/types.h>
+#endif /* not __ASSEMBLER__ */
+
+/*
+ * The boot loader leaves a small record describing what it did at a
+ * fixed physical address in page 0, just above the BIOS data area.
+ * Page 0 is never handed out by the kernel, so the record stays valid
+ * for as long as anyone cares to look at it.  The kernel reads it at
+ * KERNBASE + BOOTINFO_PADDR.
+ *
+ * bi_magic is only set by boot/main.c, so a kernel started some other
+ * way (e.g., by a Multiboot loader) can tell that the loader's part of
+ * the record is garbage.  The kernel's own timestamps (bi_ktsc) are
+ * written on every boot regardless.
+ */
+
+#define BOOTINFO_PADDR	0x500
+#define BOOTINFO_MAGIC	0xB007B007
+
+// Kernel boot stages timestamped in bi_ktsc
+#define BT_ENTRY	0	// entry in kern/entry.S
+#define BT_BSS		1	// i386_init, before clearing the BSS
+#define BT_BSS_DONE	2	// ... after clearing the BSS
+#define BT_CONS		3	// ... before cons_init
+#define BT_CONS_DONE	4	// ... after cons_init
+#define BT_PROMPT	5	// first "K> " prompt in monitor
+#define BT_NKERN	8
+
+// Loader timestamps: one as each readseg starts.  The first readseg
+// starts right as bootmain is entered, and the kernel's BT_ENTRY stamp
+// marks the end of the last one.
+#define BT_NLOADER	8
+
+// Offset of bi_ktsc, for kern/entry.S
+#define BI_KTSC		24
+
+#ifndef __ASSEMBLER__
+
+struct Bootinfo {
+	uint32_t bi_magic;	// BOOTINFO_MAGIC if written by boot/main.c
+	uint32_t bi_nsect;	// Number of sectors read from disk
+	uint32_t bi_ncmd;	// Number of ATA read commands issued
+	uint32_t bi_flags;	// BI_* flags below
+	uint32_t bi_ntsc;	// Number of valid entries in bi_tsc
+	uint32_t bi_pad;
+	uint64_t bi_ktsc[BT_NKERN];	// Kernel stage TSC stamps (BT_*)
+	uint64_t bi_tsc[BT_NLOADER];	// Loader TSC stamps
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#define BI_DMA		0x1	// Kernel was loaded with bus-master IDE DMA
+#define BI_LZ4		0x2	// Kernel was decompressed from a zimage
+
+#endif /* !JOS_INC_BOOTINFO_H */
@@ -0,0 +1,55 @@
+#ifndef JOS_INC_LINETAB_H
+#define JOS_INC_LINETAB_H
+
+#include <inc/types.h>
+
+/*
+ * Kernel address-to-line table.
+ *
+ * kern/mklinetab.c builds one of these from the stabs of a first link
+ * of the kernel, and the second link puts it in the .linetab section
+ * (see kern/Makefrag and kern/kernel.ld); kern/kdebug.c decodes it.
+ * The stabs themselves are no longer loaded.
+ *
+ * The table is a struct Linetab, then lt_nfun + 1 struct Linefuns,
+ * then the line programs, then a string table whose first byte is 0.
+ * lt_prog and lt_str are offsets from the start of the table; other
+ * offsets are into the line programs or the string table.
+ *
+ * Each Linefun covers the addresses from its lf_addr up to the next
+ * one's: a function, the code of an assembly file, or (with no file)
+ * a gap.  The last Linefun only marks where the one before it ends.
+ * A Linefun's line program runs up to the next one's lf_prog and is a
+ * list of line entries, each
+ *
+ *	uleb128	(address delta << 1) | new file
+ *	uleb128	file name string offset, if new file
+ *	sleb128	line delta
+ *
+ * with deltas from the previous entry, or from lf_addr and lf_line for
+ * the first.  An address before the first entry is at lf_line.
+ */
+
+#define LINETAB_MAGIC	0x4241544C	/* "LTAB" in little endian */
+
+struct Linetab {
+	uint32_t lt_magic;	// must equal LINETAB_MAGIC
+	uint32_t lt_etext;	// End of the .text this table describes
+	uint32_t lt_nfun;	// Linefuns, not counting the last
+	uint32_t lt_nline;	// Line entries in all line programs
+	uint32_t lt_prog;	// Offset of the line programs
+	uint32_t lt_str;	// Offset of the string table
+	uint32_t lt_size;	// Size of the whole table
+};
+
+struct Linefun {
+	uint32_t lf_addr;	// First address
+	uint32_t lf_prog;	// Offset of the line program
+	uint16_t lf_name;	// Name string offset, or 0 if not a function
+	uint16_t lf_file;	// File name string offset, or 0 if a gap
+	uint16_t lf_line;	// Line at lf_addr
+	uint8_t lf_narg;	// Number of parameters
+	uint8_t lf_pad;
+};
+
+#endif /* !JOS_INC_LINETAB_H */
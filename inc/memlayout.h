@@ -143,5 +143,37 @@
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
 
+/*
+ * Page descriptor structures, mapped at UPAGES.
+ * Read/write to the kernel, read-only to user programs.
+ *
+ * Each struct PageInfo stores metadata for one physical page.
+ * Is it NOT the physical page itself, but there is a one-to-one
+ * correspondence between physical pages and struct PageInfo's.
+ * You can map a struct PageInfo * to the corresponding physical address
+ * with page2pa() in kern/pmap.h.
+ *
+ * Free pages are kept by the buddy allocator in kern/pmap.c as blocks
+ * of 2^order pages; only the first page of a block is on a free list.
+ */
+struct PageInfo {
+	// Next and previous block on the free list of its order.
+	struct PageInfo *pp_link;
+	struct PageInfo *pp_prev;
+
+	// pp_ref is the count of pointers (usually in page table entries)
+	// to this page, for pages allocated using page_alloc.
+	// Pages allocated at boot time using pmap.c's
+	// boot_alloc do not have valid reference count fields.
+
+	uint16_t pp_ref;
+
+	// Order of the block this page heads, while free or allocated.
+	uint8_t pp_order;
+	uint8_t pp_flags;	// PP_* flags
+};
+
+#define PP_FREE		0x1	// Heads a block on a free list
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
@@ -0,0 +1,66 @@
+#ifndef JOS_INC_MULTIBOOT_H
+#define JOS_INC_MULTIBOOT_H
+
+/*
+ * Just enough of the Multiboot (version 0.6.96) specification to boot
+ * the kernel directly from a Multiboot loader such as "qemu -kernel".
+ *
+ * The header in kern/entry.S asks the loader for memory information.
+ * The loader enters the kernel with MULTIBOOT_BOOTLOADER_MAGIC in %eax
+ * and the physical address of a struct Multiboot_info in %ebx.
+ */
+
+#define MULTIBOOT_HEADER_MAGIC		0x1BADB002
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+// Multiboot header flags
+#define MULTIBOOT_PAGE_ALIGN		0x00000001	// align modules to 4KB
+#define MULTIBOOT_MEMORY_INFO		0x00000002	// pass mem_* and mmap_*
+
+// Multiboot_info flags: which of the fields below are valid
+#define MULTIBOOT_INFO_MEMORY		0x00000001	// mb_mem_lower/upper
+#define MULTIBOOT_INFO_BOOTDEV		0x00000002
+#define MULTIBOOT_INFO_CMDLINE		0x00000004	// mb_cmdline
+#define MULTIBOOT_INFO_MODS		0x00000008
+#define MULTIBOOT_INFO_MEM_MAP		0x00000040	// mb_mmap_*
+#define MULTIBOOT_INFO_LOADER_NAME	0x00000200	// mb_loader_name
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct Multiboot_info {
+	uint32_t mb_flags;		// MULTIBOOT_INFO_* flags
+	uint32_t mb_mem_lower;		// KB of memory from 0
+	uint32_t mb_mem_upper;		// KB of memory from 1MB
+	uint32_t mb_boot_device;
+	uint32_t mb_cmdline;		// PA of a NUL-terminated string
+	uint32_t mb_mods_count;
+	uint32_t mb_mods_addr;
+	uint32_t mb_syms[4];
+	uint32_t mb_mmap_length;	// Size in bytes of the memory map
+	uint32_t mb_mmap_addr;		// PA of the first Multiboot_mmap
+	uint32_t mb_drives_length;
+	uint32_t mb_drives_addr;
+	uint32_t mb_config_table;
+	uint32_t mb_loader_name;	// PA of a NUL-terminated string
+};
+
+// Memory map entries are variable-sized: mm_size gives the size of
+// the entry, not counting mm_size itself.
+struct Multiboot_mmap {
+	uint32_t mm_size;
+	uint64_t mm_addr;
+	uint64_t mm_len;
+	uint32_t mm_type;		// MULTIBOOT_MEMORY_* below
+} __attribute__((packed));
+
+#endif /* !__ASSEMBLER__ */
+
+#define MULTIBOOT_MEMORY_AVAILABLE	1
+#define MULTIBOOT_MEMORY_RESERVED	2
+#define MULTIBOOT_MEMORY_ACPI		3	// ACPI reclaimable
+#define MULTIBOOT_MEMORY_NVS		4	// ACPI non-volatile storage
+#define MULTIBOOT_MEMORY_BADRAM		5
+
+#endif /* !JOS_INC_MULTIBOOT_H */
@@ -15,6 +15,10 @@ int	iscons(int fd);
 // lib/printfmt.c
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
+void	vprintfmt_bulk(void (*putbuf)(const char*, int, void*), void *putdat, const char *fmt, va_list);
+void	printfmt_cache_init(const char *lo, const char *hi);
+int	printfmt_cache_enable(int on);
+void	printfmt_cache_stats(unsigned *hits, unsigned *misses, unsigned *bypasses);
 int	snprintf(char *str, int size, const char *fmt, ...);
 int	vsnprintf(char *str, int size, const char *fmt, va_list);
 
@@ -193,6 +193,18 @@ tlbflush(void)
 	asm volatile("movl %0,%%cr3" : : "r" (cr3));
 }
 
+static inline void
+cli(void)
+{
+	asm volatile("cli" : : : "memory");
+}
+
+static inline void
+sti(void)
+{
+	asm volatile("sti" : : : "memory");
+}
+
 static inline uint32_t
 read_eflags(void)
 {
@@ -0,0 +1,49 @@
+#ifndef JOS_INC_ZIMAGE_H
+#define JOS_INC_ZIMAGE_H
+
+#include <inc/types.h>
+
+/*
+ * Compressed kernel image format.
+ *
+ * boot/mkzimage.c turns the kernel ELF into one of these, and the
+ * second-stage boot loader built with -DZIMAGE (obj/boot/boot2z) loads
+ * it.  The image starts with a struct Zimghdr, padded to a sector.
+ * Each loadable segment's file contents follow as a run of blocks:
+ *
+ *	uint32_t size;		// compressed size of this block
+ *	uint8_t data[size];	// LZ4 block, at most ZBLKSIZE bytes decoded
+ *
+ * Blocks are compressed independently, so the loader can decode each
+ * one as soon as it has been read off the disk.
+ */
+
+#define ZIMG_MAGIC	0x474D495A	/* "ZIMG" in little endian */
+#define ZIMG_MAXSEG	8
+#define ZBLKSIZE	0x10000
+
+// The loader reads a segment's sectors into low memory from
+// ZSCRATCH_PADDR up to the I/O hole, so its first block keeps the
+// offset within a 512-byte sector that it has in the image.
+// mkzimage and the loader both check segments with ZSEG_FITS.
+#define ZSCRATCH_PADDR	0x20000
+#define ZSCRATCH_END	0xA0000
+#define ZSEG_FITS(zs) \
+	((zs)->zs_size <= ZSCRATCH_END - ZSCRATCH_PADDR - (zs)->zs_offset % 512)
+
+struct Zseg {
+	uint32_t zs_pa;		// Load address
+	uint32_t zs_filesz;	// Size of the decompressed contents
+	uint32_t zs_memsz;	// Size in memory; the rest is zero-filled
+	uint32_t zs_offset;	// Image offset of the first block
+	uint32_t zs_size;	// Total size of the blocks
+};
+
+struct Zimghdr {
+	uint32_t z_magic;	// must equal ZIMG_MAGIC
+	uint32_t z_entry;	// Entry point (physical)
+	uint32_t z_nseg;
+	struct Zseg z_seg[ZIMG_MAXSEG];
+};
+
+#endif /* !JOS_INC_ZIMAGE_H */
@@ -0,0 +1,130 @@
+// The boot info record left in page 0 by the boot loader,
+// and the boot timeline built from its timestamps.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/bootinfo.h>
+#include <kern/console.h>
+#include <kern/tsc.h>
+#include <kern/log.h>
+
+#define BI	((struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR))
+
+static const char * const stage_name[BT_NKERN] = {
+	[BT_ENTRY]	= "entry",
+	[BT_BSS]	= "bss",
+	[BT_BSS_DONE]	= "bss_done",
+	[BT_CONS]	= "cons_init",
+	[BT_CONS_DONE]	= "cons_init_done",
+	[BT_PROMPT]	= "prompt",
+};
+
+static bool
+bootinfo_valid(void)
+{
+	return BI->bi_magic == BOOTINFO_MAGIC;
+}
+
+// Report what the boot loader left behind in the boot info record.
+void
+bootinfo_print(void)
+{
+	if (!bootinfo_valid())
+		return;
+	kinfo(LOG_KERN, "boot: loaded %u sectors with %u %s read commands%s\n",
+		BI->bi_nsect, BI->bi_ncmd, BI->bi_flags & BI_DMA ? "DMA" : "PIO",
+		BI->bi_flags & BI_LZ4 ? " (compressed kernel)" : "");
+}
+
+// Forget the kernel stage stamps from any previous boot, except for
+// BT_ENTRY, which entry.S has just taken.
+void
+boottime_reset(void)
+{
+	memset(&BI->bi_ktsc[BT_ENTRY + 1], 0,
+	       sizeof(BI->bi_ktsc) - sizeof(BI->bi_ktsc[0]) * (BT_ENTRY + 1));
+}
+
+void
+boottime_stamp(int stage)
+{
+	BI->bi_ktsc[stage] = read_tsc();
+}
+
+// Called just before the monitor prints its prompt.  The first time,
+// stamp BT_PROMPT and send the timeline to the serial port.
+void
+boottime_prompt(void)
+{
+	if (BI->bi_ktsc[BT_PROMPT])
+		return;
+	boottime_stamp(BT_PROMPT);
+	boottime_print(1);
+}
+
+// Print one line of the timeline.  'machine' selects the serial-only
+// format "boottime <stage> <tsc> <delta cycles> <delta us>".
+static void
+boottime_line(bool machine, const char *name, int n, uint64_t tsc,
+	      uint64_t prev, uint64_t first)
+{
+	char buf[96];
+	char label[24];
+
+	if (n >= 0)
+		snprintf(label, sizeof(label), "%s%d", name, n);
+	else
+		snprintf(label, sizeof(label), "%s", name);
+
+	if (machine) {
+		snprintf(buf, sizeof(buf), "boottime %s %llu %llu %llu\n",
+			 label, tsc, tsc - prev, tsc_to_us(tsc - prev));
+		serial_puts(buf);
+	} else
+		cprintf("  %-16s %12llu %10llu %10llu\n", label,
+			tsc - prev, tsc_to_us(tsc - prev), tsc_to_us(tsc - first));
+}
+
+// Print the boot timeline: the loader's stamps (if we were booted by
+// boot/main.c) followed by the kernel's, each with the time since the
+// one before it.
+void
+boottime_print(bool machine)
+{
+	uint64_t first, prev;
+	int i, n;
+
+	first = BI->bi_ktsc[BT_ENTRY];
+	n = 0;
+	if (bootinfo_valid()) {
+		n = MIN(BI->bi_ntsc, (uint32_t) BT_NLOADER);
+		if (n > 0)
+			first = BI->bi_tsc[0];
+	}
+	prev = first;
+
+	if (machine) {
+		char buf[48];
+
+		snprintf(buf, sizeof(buf), "boottime hz %llu\n", tsc_freq());
+		serial_puts(buf);
+	} else
+		cprintf("  %-16s %12s %10s %10s\n",
+			"stage", "cycles", "us", "total us");
+
+	for (i = 0; i < n; i++) {
+		boottime_line(machine, i ? "readseg" : "bootmain", i ? i : -1,
+			      BI->bi_tsc[i], prev, first);
+		prev = BI->bi_tsc[i];
+	}
+	for (i = 0; i < BT_NKERN; i++) {
+		if (!stage_name[i] || !BI->bi_ktsc[i])
+			continue;
+		boottime_line(machine, stage_name[i], -1,
+			      BI->bi_ktsc[i], prev, first);
+		prev = BI->bi_ktsc[i];
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef JOS_KERN_BOOTINFO_H
+#define JOS_KERN_BOOTINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/bootinfo.h>
+
+void bootinfo_print(void);
+
+void boottime_reset(void);
+void boottime_stamp(int stage);
+void boottime_prompt(void);
+void boottime_print(bool machine);
+
+#endif	// !JOS_KERN_BOOTINFO_H
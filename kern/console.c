@@ -5,10 +5,29 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/trap.h>
 
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/picirq.h>
+#include <kern/klog.h>
+#include <kern/trace.h>
+#include <kern/log.h>
+
+// Where console input comes from, and what became of it
+struct Cons_input {
+	const char *ci_name;
+	bool ci_hold;		// Leave input in the device when the buffer
+				// is full, rather than dropping it
+	bool ci_held;		// Holding input since the last character
+	uint32_t ci_nchars;	// Characters put in the buffer
+	uint32_t ci_ndrops;	// ... and dropped because it was full
+	uint32_t ci_nholds;	// Times the input went from flowing to held
+	uint32_t ci_noverruns;	// Characters the device itself lost
+};
 
-static void cons_intr(int (*proc)(void));
+static bool cons_intr(int (*proc)(void), struct Cons_input *in);
 static void cons_putc(int c);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
@@ -31,8 +50,14 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled (16550A)
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE	0x01	//   Enable the FIFOs
+#define   COM_FCR_RCV_RESET	0x02	//   Clear the receive FIFO
+#define   COM_FCR_XMT_RESET	0x04	//   Clear the transmit FIFO
+#define   COM_FCR_TRIGGER_8	0x80	//   Receive interrupt at 8 bytes
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -42,84 +67,280 @@ delay(void)
 #define	  COM_MCR_OUT2	0x08	// Out2 complement
 #define COM_LSR		5	// In:	Line Status Register
 #define   COM_LSR_DATA	0x01	//   Data available
+#define   COM_LSR_OE	0x02	//   Overrun error
 #define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
+#define COM_FIFOSIZE	16	// Transmit FIFO depth of a 16550A
+
+#define SERIAL_BAUD	115200	// Initial line speed
+
+// Output waits in serial_tx until the UART can take it.  The
+// transmitter-empty interrupt (or, with interrupts off, the next
+// serial_write or input poll) moves up to a FIFO-full at a time out to
+// the UART, so serial_write only waits when the ring is full.
+#define SERIAL_TXBUFSIZE	4096	// Must be a power of 2
+
+static struct {
+	uint8_t buf[SERIAL_TXBUFSIZE];
+	uint32_t rpos;		// Next byte to send
+	uint32_t wpos;		// Next free slot; wpos - rpos bytes queued
+} serial_tx;
+
 static bool serial_exists;
+static int serial_fifo;		// Bytes the UART takes per THRE: 16 or 1
+static uint8_t serial_ier;	// Current COM_IER value
+static unsigned serial_baud;
+static bool serial_held;	// Receiving is off until the buffer drains
+
+// The serial port holds its input when the console buffer is full:
+// the UART's FIFO, and with it the sender, waits for the reader.
+static struct Cons_input serial_input = { "serial", 1 };
+
+// Move as much queued output to the UART as it will take.
+// Called with interrupts disabled.
+static void
+serial_tx_drain(void)
+{
+	int n;
+
+	if (serial_tx.rpos != serial_tx.wpos
+	    && (inb(COM1+COM_LSR) & COM_LSR_TXRDY))
+		for (n = 0; n < serial_fifo && serial_tx.rpos != serial_tx.wpos; n++)
+			outb(COM1+COM_TX,
+			     serial_tx.buf[serial_tx.rpos++ % SERIAL_TXBUFSIZE]);
+
+	// Ask for an interrupt when the UART runs dry only while there is
+	// more to send.
+	if ((serial_tx.rpos != serial_tx.wpos) != !!(serial_ier & COM_IER_TXI)) {
+		serial_ier ^= COM_IER_TXI;
+		outb(COM1+COM_IER, serial_ier);
+	}
+}
 
 static int
 serial_proc_data(void)
 {
-	if (!(inb(COM1+COM_LSR) & COM_LSR_DATA))
+	uint8_t lsr;
+
+	lsr = inb(COM1+COM_LSR);
+	if (lsr & COM_LSR_OE)
+		serial_input.ci_noverruns++;
+	if (!(lsr & COM_LSR_DATA))
 		return -1;
 	return inb(COM1+COM_RX);
 }
 
+// Stop (hold) or restart receiving: turn the receive interrupt off so
+// it doesn't fire for input we won't take, and drop RTS so a sender
+// doing flow control stops too.  Called with interrupts disabled.
+static void
+serial_hold(bool hold)
+{
+	klog(hold ? "serial: input buffer full, holding input"
+	     : "serial: resuming input");
+	serial_held = hold;
+	if (hold)
+		serial_ier &= ~COM_IER_RDI;
+	else
+		serial_ier |= COM_IER_RDI;
+	outb(COM1+COM_IER, serial_ier);
+	outb(COM1+COM_MCR, COM_MCR_OUT2 | COM_MCR_DTR
+	     | (hold ? 0 : COM_MCR_RTS));
+}
+
+// Called by cons_getc once it has made room in the buffer.
+static void
+serial_resume(void)
+{
+	uint32_t eflags;
+
+	eflags = read_eflags();
+	cli();
+	if (serial_held)
+		serial_hold(0);
+	write_eflags(eflags);
+}
+
+// Called from the serial interrupt handler, and by cons_getc to poll:
+// receive input and keep the transmitter busy.
 void
 serial_intr(void)
 {
-	if (serial_exists)
-		cons_intr(serial_proc_data);
+	uint32_t eflags;
+
+	if (!serial_exists)
+		return;
+	eflags = read_eflags();
+	cli();
+	if (!cons_intr(serial_proc_data, &serial_input) && !serial_held)
+		serial_hold(1);
+	serial_tx_drain();
+	write_eflags(eflags);
 }
 
 static void
-serial_putc(int c)
+serial_write(const char *buf, size_t n)
 {
-	int i;
+	uint32_t eflags;
 
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
-		delay();
+	if (!serial_exists)
+		return;
+	eflags = read_eflags();
+	cli();
+	while (n-- > 0) {
+		// Wait for room in the ring, the old-fashioned way
+		while (serial_tx.wpos - serial_tx.rpos == SERIAL_TXBUFSIZE)
+			serial_tx_drain();
+		serial_tx.buf[serial_tx.wpos++ % SERIAL_TXBUFSIZE] = *buf++;
+	}
+	serial_tx_drain();
+	write_eflags(eflags);
+}
 
-	outb(COM1 + COM_TX, c);
+// Write a string to the serial port only, e.g. for output meant
+// for a program reading the serial log rather than for humans.
+void
+serial_puts(const char *s)
+{
+	serial_write(s, strlen(s));
 }
 
-static void
-serial_init(void)
+// Wait until everything queued has left the UART.
+void
+serial_flush(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	uint32_t eflags;
+
+	if (!serial_exists)
+		return;
+	eflags = read_eflags();
+	cli();
+	while (serial_tx.rpos != serial_tx.wpos)
+		serial_tx_drain();
+	while (!(inb(COM1+COM_LSR) & COM_LSR_TSRE))
+		/* do nothing */;
+	write_eflags(eflags);
+}
 
-	// Set speed; requires DLAB latch
+// Set the line speed.  'baud' must divide 115200 evenly.
+// Returns 0 on success, or -E_INVAL.
+int
+serial_set_baud(unsigned baud)
+{
+	uint32_t eflags;
+
+	if (baud == 0 || baud > 115200 || 115200 % baud != 0)
+		return -E_INVAL;
+	serial_flush();
+	serial_baud = baud;
+	klog("serial: %u baud", baud);
+
+	// Set speed; requires DLAB latch.  While it is set, COM_RX and
+	// COM_IER are the divisor, so keep serial_intr out until it's clear.
+	eflags = read_eflags();
+	cli();
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
-	outb(COM1+COM_DLM, 0);
+	outb(COM1+COM_DLL, (uint8_t) (115200 / baud));
+	outb(COM1+COM_DLM, (uint8_t) ((115200 / baud) >> 8));
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
+	write_eflags(eflags);
+	return 0;
+}
 
-	// No modem controls
-	outb(COM1+COM_MCR, 0);
-	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+unsigned
+serial_get_baud(void)
+{
+	return serial_exists ? serial_baud : 0;
+}
+
+static void
+serial_init(void)
+{
+	// Turn on the FIFOs, emptying them
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RCV_RESET
+	     | COM_FCR_XMT_RESET | COM_FCR_TRIGGER_8);
+
+	serial_set_baud(SERIAL_BAUD);
+
+	// OUT2 gates the UART's interrupt line on PCs; DTR and RTS
+	// tell the other end we are ready (see serial_hold)
+	outb(COM1+COM_MCR, COM_MCR_OUT2 | COM_MCR_DTR | COM_MCR_RTS);
+	// Enable rcv interrupts; serial_tx_drain turns on transmit
+	// interrupts when there is output waiting
+	serial_ier = COM_IER_RDI;
+	outb(COM1+COM_IER, serial_ier);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// Only a 16550A's FIFOs work
+	serial_fifo = (inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO
+		? COM_FIFOSIZE : 1;
 	(void) inb(COM1+COM_RX);
 
+	// Enable serial interrupts
+	if (serial_exists)
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
 }
 
+static bool
+serial_probe(void)
+{
+	serial_init();
+	if (!serial_exists)
+		kwarn(LOG_CONS, "serial port does not exist");
+	return serial_exists;
+}
+
+static struct Cons_sink serial_sink = {
+	"serial", serial_probe, serial_write
+};
+
 
 
 /***** Parallel port output code *****/
 // For information on PC parallel port programming, see the class References
 // page.
 
+#define LPT1		0x378
+
 static void
 lpt_putc(int c)
 {
 	int i;
 
-	for (i = 0; !(inb(0x378+1) & 0x80) && i < 12800; i++)
+	for (i = 0; !(inb(LPT1+1) & 0x80) && i < 12800; i++)
 		delay();
-	outb(0x378+0, c);
-	outb(0x378+2, 0x08|0x04|0x01);
-	outb(0x378+2, 0x08);
+	outb(LPT1+0, c);
+	outb(LPT1+2, 0x08|0x04|0x01);
+	outb(LPT1+2, 0x08);
+}
+
+static void
+lpt_write(const char *buf, size_t n)
+{
+	while (n-- > 0)
+		lpt_putc(*buf++);
+}
+
+// There is a parallel port if its data register holds what we write.
+static bool
+lpt_probe(void)
+{
+	outb(LPT1+0, 0xAA);
+	if (inb(LPT1+0) != 0xAA)
+		return 0;
+	outb(LPT1+0, 0x55);
+	return inb(LPT1+0) == 0x55;
 }
 
+static struct Cons_sink lpt_sink = {
+	"lpt", lpt_probe, lpt_write
+};
+
 
 
 
@@ -127,14 +348,57 @@ lpt_putc(int c)
 
 static unsigned addr_6845;
 static uint16_t *crt_buf;
-static uint16_t crt_pos;
+static uint16_t crt_pos;	// Cursor, as an offset into crt_buf
+static uint16_t crt_top;	// Offset of the live screen's first row
+static uint16_t crt_view;	// Offset of the first row on display
+static uint16_t crt_cells;	// Whole rows of text memory in crt_buf
+static uint16_t crt_cursor;	// Cursor position the CRTC has
+
+// Characters are written to a shadow of the live screen in RAM and
+// copied to text memory a row at a time by cga_flush, which is also
+// the only place the cursor moves.  The shadow is a ring of rows:
+// crt_srow is the shadow row holding the top of the screen, so a
+// scroll just recycles it as the new bottom row.
+static uint16_t crt_shadow[CRT_ROWS][CRT_COLS];
+static int crt_srow;
+static uint32_t crt_dirty;	// Bit i: crt_shadow[i] needs copying
+
+// Copy 'n' 16-bit words from 'src' to 'dst' with one rep movsw.
+static inline void
+cga_movsw(uint16_t *dst, const uint16_t *src, int n)
+{
+	asm volatile("cld\n\trep movsw"
+		     : "+D" (dst), "+S" (src), "+c" (n)
+		     : : "memory", "cc");
+}
+
+// Point the CRTC's display start address at offset 'off' of crt_buf.
+static void
+cga_set_start(uint16_t off)
+{
+	outb(addr_6845, 12);
+	outb(addr_6845 + 1, off >> 8);
+	outb(addr_6845, 13);
+	outb(addr_6845 + 1, off);
+}
+
+static void
+cga_set_cursor(uint16_t pos)
+{
+	outb(addr_6845, 14);
+	outb(addr_6845 + 1, pos >> 8);
+	outb(addr_6845, 15);
+	outb(addr_6845 + 1, pos);
+	crt_cursor = pos;
+}
 
 static void
 cga_init(void)
 {
 	volatile uint16_t *cp;
 	uint16_t was;
-	unsigned pos;
+	unsigned pos, start;
+	int r;
 
 	cp = (uint16_t*) (KERNBASE + CGA_BUF);
 	was = *cp;
@@ -153,11 +417,164 @@ cga_init(void)
 	outb(addr_6845, 15);
 	pos |= inb(addr_6845 + 1);
 
+	/* ... and where the BIOS left the display start */
+	outb(addr_6845, 12);
+	start = inb(addr_6845 + 1) << 8;
+	outb(addr_6845, 13);
+	start |= inb(addr_6845 + 1);
+
 	crt_buf = (uint16_t*) cp;
 	crt_pos = pos;
+
+	// A color adapter has 32KB of text memory to scroll through;
+	// an MDA has only the one screen.
+	if (addr_6845 == CGA_BASE)
+		crt_cells = ROUNDDOWN(CGA_MEMSIZE / sizeof(uint16_t), CRT_COLS);
+	else
+		crt_cells = CRT_SIZE;
+	crt_top = ROUNDDOWN(start, CRT_COLS);
+	if (crt_top + CRT_SIZE > crt_cells || crt_pos < crt_top
+	    || crt_pos >= crt_top + CRT_SIZE) {
+		crt_top = 0;
+		crt_pos %= CRT_SIZE;
+	}
+	crt_view = crt_top;
+	cga_set_start(crt_top);
+	cga_set_cursor(crt_pos);
+
+	// Start the shadow off with what is on the screen
+	crt_srow = 0;
+	crt_dirty = 0;
+	for (r = 0; r < CRT_ROWS; r++)
+		cga_movsw(crt_shadow[r], crt_buf + crt_top + r * CRT_COLS,
+			  CRT_COLS);
+}
+
+// Copy shadow row 'i' to its place in text memory.
+static void
+cga_flush_row(int i)
+{
+	int row = (i - crt_srow + CRT_ROWS) % CRT_ROWS;
+
+	cga_movsw(crt_buf + crt_top + row * CRT_COLS, crt_shadow[i], CRT_COLS);
+	crt_dirty &= ~(1 << i);
+}
+
+static void
+cga_flush_rows(void)
+{
+	int i;
+
+	for (i = 0; crt_dirty; i++)
+		if (crt_dirty & (1 << i))
+			cga_flush_row(i);
+}
+
+// Bring text memory, the display start, and the cursor up to date
+// with the shadow.
+static void
+cga_flush(void)
+{
+	uint32_t eflags;
+
+	// Keep out the keyboard interrupt, which may scroll back
+	eflags = read_eflags();
+	cli();
+	cga_flush_rows();
+
+	// New output brings the display back to the live screen
+	if (crt_view != crt_top) {
+		crt_view = crt_top;
+		cga_set_start(crt_view);
+	}
+
+	/* move that little blinky thing */
+	if (crt_cursor != crt_pos)
+		cga_set_cursor(crt_pos);
+	write_eflags(eflags);
 }
 
+// Return the shadow cell for offset 'pos' of the live screen,
+// marking its row dirty.
+static uint16_t *
+cga_cell(uint16_t pos)
+{
+	int i = (crt_srow + (pos - crt_top) / CRT_COLS) % CRT_ROWS;
+
+	crt_dirty |= 1 << i;
+	return &crt_shadow[i][pos % CRT_COLS];
+}
+
+// Scroll the live screen up a row by moving the display start down
+// through text memory.  Only when the screen reaches the end of text
+// memory is anything copied: the newest half of memory (or, on an MDA,
+// all but the top row) moves back to the start, and what remains above
+// the screen is scrollback.
+static void
+cga_scroll(void)
+{
+	int i, keep, shift, top = crt_top + CRT_COLS;
+
+	// The top row goes into the scrollback, so text memory must
+	// have it; its shadow becomes the new, blank, bottom row.
+	if (top + CRT_SIZE > crt_cells) {
+		// Everything is flushed before the copy, and the new top
+		// is at least keep - CRT_SIZE + CRT_COLS >= 0.
+		cga_flush_rows();
+		keep = MAX(ROUNDDOWN(crt_cells / 2, CRT_COLS), CRT_SIZE - CRT_COLS);
+		shift = crt_cells - keep;
+		memmove(crt_buf, crt_buf + shift, keep * sizeof(uint16_t));
+		top -= shift;
+		crt_pos -= shift;
+	} else if (crt_dirty & (1 << crt_srow))
+		cga_flush_row(crt_srow);
+	for (i = 0; i < CRT_COLS; i++)
+		crt_shadow[crt_srow][i] = 0x0700 | ' ';
+	crt_dirty |= 1 << crt_srow;
+	crt_srow = (crt_srow + 1) % CRT_ROWS;
+	crt_top = top;
+}
+
+// Move the display 'rows' rows back (negative: forward) through the
+// scrollback, stopping at the oldest row text memory still holds and
+// at the live screen.
+static void
+cga_scrollback(int rows)
+{
+	int view;
+
+	cga_flush_rows();
+	view = crt_view - rows * CRT_COLS;
+	view = MAX(view, 0);
+	view = MIN(view, (int) crt_top);
+	if (view != crt_view) {
+		crt_view = view;
+		cga_set_start(crt_view);
+	}
+}
+
+
 
+static void cga_putc(int c);
+
+// Write a run of characters to the shadow.  A newline flushes, so a
+// line shows up as soon as it is finished.
+static void
+cga_write(const char *buf, size_t n)
+{
+	uint32_t eflags;
+	int c;
+
+	eflags = read_eflags();
+	cli();
+	while (n-- > 0) {
+		c = *buf++ & 0xFF;
+		cga_putc(c);
+		if (c == '\n')
+			cga_flush();
+	}
+	write_eflags(eflags);
+}
 
 static void
 cga_putc(int c)
@@ -168,9 +585,9 @@ cga_putc(int c)
 
 	switch (c & 0xff) {
 	case '\b':
-		if (crt_pos > 0) {
+		if (crt_pos > crt_top) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			*cga_cell(crt_pos) = (c & ~0xff) | ' ';
 		}
 		break;
 	case '\n':
@@ -180,34 +597,57 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		*cga_cell(crt_pos++) = c;	/* write the character */
 		break;
 	}
 
-	// What is the purpose of this?
-	if (crt_pos >= CRT_SIZE) {
-		int i;
+	if (crt_pos >= crt_top + CRT_SIZE)
+		cga_scroll();
+}
 
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
-		crt_pos -= CRT_COLS;
-	}
+static bool
+cga_probe(void)
+{
+	cga_init();
+	return 1;
+}
 
-	/* move that little blinky thing */
-	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
-	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+static struct Cons_sink cga_sink = {
+	"cga", cga_probe, cga_write, cga_flush
+};
+
+
+/***** QEMU/Bochs debug console *****/
+
+// Whatever is written to port 0xE9 shows up on QEMU's -debugcon
+// device, which the qemu targets send to debugcon.log: no status to
+// poll, and a whole run goes out with one rep outsb.  Reading the port
+// returns 0xE9 if the device is there.
+#define DEBUGCON	0xE9
+
+static void
+debugcon_write(const char *buf, size_t n)
+{
+	outsb(DEBUGCON, buf, n);
+}
+
+static bool
+debugcon_probe(void)
+{
+	return inb(DEBUGCON) == DEBUGCON;
 }
 
+static struct Cons_sink debugcon_sink = {
+	"debugcon", debugcon_probe, debugcon_write
+};
+
 
 /***** Keyboard input code *****/
 
@@ -361,18 +801,31 @@ kbd_proc_data(void)
 		outb(0x92, 0x3); // courtesy of Chris Frost
 	}
 
+	// PgUp/PgDn: browse the display's scrollback
+	if (c == KEY_PGUP || c == KEY_PGDN) {
+		cga_scrollback(c == KEY_PGUP ? CRT_ROWS - 1 : -(CRT_ROWS - 1));
+		return 0;
+	}
+
 	return c;
 }
 
+// The keyboard controller holds just one byte, so there is no point
+// leaving keys in it: if the buffer is full, they are dropped.
+static struct Cons_input kbd_input = { "kbd", 0 };
+
 void
 kbd_intr(void)
 {
-	cons_intr(kbd_proc_data);
+	cons_intr(kbd_proc_data, &kbd_input);
 }
 
 static void
 kbd_init(void)
 {
+	// Drain the 8042 so it will raise IRQ 1 for the next key
+	kbd_intr();
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
 }
 
 
@@ -382,27 +835,60 @@ kbd_init(void)
 // where we stash characters received from the keyboard or serial port
 // whenever the corresponding interrupt occurs.
 
-#define CONSBUFSIZE 512
+// The buffer is a single-producer, single-consumer ring and takes no
+// locks.  The producers are the keyboard and serial interrupt handlers
+// (and cons_getc polling them), which run with interrupts off and so
+// never overlap: only they write wpos.  Only the reader, cons_getc,
+// writes rpos.  Each side publishes its position with a release store
+// after touching the buffer, and reads the other's with an acquire
+// load before it does.
+
+#define CONSBUFSIZE 512		// Must be a power of 2
 
 static struct {
 	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	uint32_t rpos;		// Next character to read
+	uint32_t wpos;		// Next free slot; wpos - rpos are queued
+	uint32_t maxfill;	// Most characters ever queued at once
 } cons;
 
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
-static void
-cons_intr(int (*proc)(void))
+// Returns 0 if it stopped because the buffer is full and 'in' holds
+// its input, 1 once the device has no more input.
+static bool
+cons_intr(int (*proc)(void), struct Cons_input *in)
 {
+	uint32_t wpos, fill;
 	int c;
 
-	while ((c = (*proc)()) != -1) {
+	wpos = cons.wpos;
+	for (;;) {
+		fill = wpos - __atomic_load_n(&cons.rpos, __ATOMIC_ACQUIRE);
+		if (fill == CONSBUFSIZE && in->ci_hold) {
+			// Count each stall once, not every poll during it
+			if (!in->ci_held)
+				in->ci_nholds++;
+			in->ci_held = 1;
+			return 0;
+		}
+		if ((c = (*proc)()) == -1)
+			return 1;
 		if (c == 0)
 			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+		if (fill == CONSBUFSIZE) {
+			klog("%s: input buffer full, dropped 0x%02x",
+			     in->ci_name, c);
+			in->ci_ndrops++;
+			continue;
+		}
+		cons.buf[wpos & (CONSBUFSIZE - 1)] = c;
+		__atomic_store_n(&cons.wpos, ++wpos, __ATOMIC_RELEASE);
+		TRACE(TR_CONS_INTR, c, in->ci_name, fill + 1);
+		in->ci_held = 0;
+		in->ci_nchars++;
+		if (fill + 1 > cons.maxfill)
+			cons.maxfill = fill + 1;
 	}
 }
 
@@ -410,43 +896,149 @@ cons_intr(int (*proc)(void))
 int
 cons_getc(void)
 {
+	uint32_t eflags, rpos;
 	int c;
 
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
 	serial_intr();
+	eflags = read_eflags();
+	cli();
 	kbd_intr();
+	write_eflags(eflags);
 
 	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
+	rpos = cons.rpos;
+	if (rpos == __atomic_load_n(&cons.wpos, __ATOMIC_ACQUIRE))
+		return 0;
+	c = cons.buf[rpos & (CONSBUFSIZE - 1)];
+	__atomic_store_n(&cons.rpos, rpos + 1, __ATOMIC_RELEASE);
+
+	// There is room now for any input the serial port was holding
+	serial_resume();
+	return c;
+}
+
+void
+cons_input_print(void)
+{
+	static struct Cons_input * const inputs[] = {
+		&kbd_input, &serial_input
+	};
+	struct Cons_input *in;
+	int i;
+
+	cprintf("Input buffer: %u of %d bytes queued, at most %u\n",
+		cons.wpos - cons.rpos, CONSBUFSIZE, cons.maxfill);
+	cprintf("  %-10s %10s %10s %10s %10s\n",
+		"input", "chars", "dropped", "held", "overruns");
+	for (i = 0; i < ARRAY_SIZE(inputs); i++) {
+		in = inputs[i];
+		cprintf("  %-10s %10u %10u %10u %10u\n", in->ci_name,
+			in->ci_nchars, in->ci_ndrops, in->ci_nholds,
+			in->ci_noverruns);
 	}
-	return 0;
+}
+
+// The output devices.  Each one is probed when it is registered and
+// written to only if it is there and enabled.
+
+#define CONS_MAXSINKS	8
+
+static struct Cons_sink *cons_sinks[CONS_MAXSINKS];
+static int cons_nsinks;
+
+// Add an output device to the console, enabling it if its probe
+// finds it.
+void
+cons_sink_register(struct Cons_sink *sink)
+{
+	if (cons_nsinks == CONS_MAXSINKS)
+		panic("too many console sinks");
+	cons_sinks[cons_nsinks++] = sink;
+	sink->cs_present = sink->cs_probe();
+	sink->cs_enabled = sink->cs_present;
+}
+
+// Turn console output to the sink called 'name' on or off.
+// Returns 0 on success, -E_INVAL if there is no such sink or
+// it is not present.
+int
+cons_sink_enable(const char *name, bool on)
+{
+	int i;
+
+	for (i = 0; i < cons_nsinks; i++)
+		if (strcmp(cons_sinks[i]->cs_name, name) == 0) {
+			if (!cons_sinks[i]->cs_present)
+				return -E_INVAL;
+			cons_sinks[i]->cs_enabled = on;
+			return 0;
+		}
+	return -E_INVAL;
+}
+
+void
+cons_sink_print(void)
+{
+	struct Cons_sink *sink;
+	int i;
+
+	for (i = 0; i < cons_nsinks; i++) {
+		sink = cons_sinks[i];
+		cprintf("  %-10s %s\n", sink->cs_name,
+			!sink->cs_present ? "not present"
+			: sink->cs_enabled ? "on" : "off");
+	}
+}
+
+// output a run of characters to the console, handing all of it to
+// each device at once
+void
+cons_write(const char *buf, size_t n)
+{
+	int i;
+
+	if (n == 0)
+		return;
+	for (i = 0; i < cons_nsinks; i++)
+		if (cons_sinks[i]->cs_enabled)
+			cons_sinks[i]->cs_write(buf, n);
+}
+
+// Push out anything the sinks are holding back, e.g., the cursor
+// position.  Called at the end of each cprintf and before waiting
+// for input.
+void
+cons_flush(void)
+{
+	int i;
+
+	for (i = 0; i < cons_nsinks; i++)
+		if (cons_sinks[i]->cs_enabled && cons_sinks[i]->cs_flush)
+			cons_sinks[i]->cs_flush();
 }
 
 // output a character to the console
 static void
 cons_putc(int c)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	char ch = c;
+
+	cons_write(&ch, 1);
 }
 
 // initialize the console devices
 void
 cons_init(void)
 {
-	cga_init();
+	cons_sink_register(&cga_sink);
+	// After the CGA, since PgUp/PgDn scroll it
 	kbd_init();
-	serial_init();
-
-	if (!serial_exists)
-		cprintf("Serial port does not exist!\n");
+	cons_sink_register(&serial_sink);
+	cons_sink_register(&lpt_sink);
+	cons_sink_register(&debugcon_sink);
 }
 
 
@@ -463,8 +1055,26 @@ getchar(void)
 {
 	int c;
 
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	cons_flush();
+
+	while ((c = cons_getc()) == 0) {
+		// Use the time spent waiting to zero pages for later
+		if (page_zero_idle())
+			continue;
+		// With interrupts off, all we can do is keep polling.
+		if (!(read_eflags() & FL_IF))
+			continue;
+		// Otherwise sleep until the keyboard or serial interrupt
+		// handler puts something in the buffer.  Check the buffer
+		// with interrupts off and sti right before hlt: sti holds
+		// off interrupts for one more instruction, so one arriving
+		// after the check still wakes us up.
+		cli();
+		if (cons.rpos == cons.wpos)
+			asm volatile("sti; hlt");
+		else
+			sti();
+	}
 	return c;
 }
 
@@ -12,15 +12,37 @@
 #define MONO_BUF	0xB0000
 #define CGA_BASE	0x3D4
 #define CGA_BUF		0xB8000
+#define CGA_MEMSIZE	0x8000	// 32KB of color text memory
 
 #define CRT_ROWS	25
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
+// A console output device.
+struct Cons_sink {
+	const char *cs_name;
+	bool (*cs_probe)(void);		// Set up the device; is it there?
+	void (*cs_write)(const char *buf, size_t n);
+	void (*cs_flush)(void);		// Catch up on held output, or NULL
+	bool cs_present;
+	bool cs_enabled;
+};
+
 void cons_init(void);
 int cons_getc(void);
+void cons_write(const char *buf, size_t n);
+void cons_flush(void);
+
+void cons_sink_register(struct Cons_sink *sink);
+int cons_sink_enable(const char *name, bool on);
+void cons_sink_print(void);
+void cons_input_print(void);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
+void serial_puts(const char *s);
+void serial_flush(void);
+int serial_set_baud(unsigned baud);
+unsigned serial_get_baud(void);
 
 #endif /* _CONSOLE_H_ */
@@ -0,0 +1,146 @@
+// Panic flight recorder (see kern/crash.h).
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/bootinfo.h>
+
+#include <kern/crash.h>
+#include <kern/kdebug.h>
+#include <kern/klog.h>
+#include <kern/trace.h>
+
+#define CRASHREC	((struct Crashrec *) (KERNBASE + CRASH_PADDR))
+
+// The previous boot's crash record, if it left one
+static struct Crashrec lastcrash;
+static bool havecrash;
+
+static uint32_t
+crash_sum(const struct Crashrec *cr)
+{
+	const uint32_t *w = (const uint32_t *) cr;
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < sizeof(*cr) / sizeof(uint32_t); i++)
+		sum += w[i];
+	return sum;
+}
+
+// Print a crash record.  For a live panic ('old' false), _panic has
+// already announced it, so the header is left out.  For one from an
+// earlier boot, the trace payload pointers are printed, not followed.
+static void
+crash_print_rec(const struct Crashrec *cr, bool old)
+{
+	const struct Crashframe *cf;
+	int i;
+
+	if (old)
+		cprintf("kernel panic at %s:%d: %s\n",
+			cr->cr_file, cr->cr_line, cr->cr_msg);
+	cprintf("  esp  0x%08x  ebp  0x%08x  flag 0x%08x\n",
+		cr->cr_esp, cr->cr_ebp, cr->cr_eflags);
+	cprintf("  cr0  0x%08x  cr2  0x%08x  cr3  0x%08x  cr4  0x%08x\n",
+		cr->cr_cr0, cr->cr_cr2, cr->cr_cr3, cr->cr_cr4);
+
+	cprintf("Stack backtrace:\n");
+	for (i = 0; i < cr->cr_nframes; i++) {
+		cf = &cr->cr_frames[i];
+		cprintf("  eip %08x  %s:%d: %s\n",
+			cf->cf_eip, cf->cf_file, cf->cf_line, cf->cf_fn);
+	}
+
+	if (cr->cr_ntrace > 0) {
+		cprintf("Last %d trace events:\n", cr->cr_ntrace);
+		for (i = 0; i < cr->cr_ntrace; i++)
+			trace_print_rec(&cr->cr_trace[i], old);
+	}
+}
+
+// Called by _panic, with the panic message and its arguments: print
+// everything that might explain the panic, and save it in the crash
+// record.
+void
+crash_panic(const char *file, int line, const char *fmt, va_list ap)
+{
+	struct Crashrec *cr = CRASHREC;
+	struct Crashframe *cf;
+	struct Eipdebuginfo info;
+	uint32_t *ebp;
+
+	memset(cr, 0, sizeof(*cr));
+	cr->cr_tsc = read_tsc();
+	strlcpy(cr->cr_file, file, sizeof(cr->cr_file));
+	cr->cr_line = line;
+	vsnprintf(cr->cr_msg, sizeof(cr->cr_msg), fmt, ap);
+
+	cr->cr_esp = read_esp();
+	cr->cr_ebp = read_ebp();
+	cr->cr_eflags = read_eflags();
+	cr->cr_cr0 = rcr0();
+	cr->cr_cr2 = rcr2();
+	cr->cr_cr3 = rcr3();
+	cr->cr_cr4 = rcr4();
+
+	// Walk the stack from here up, for as long as the frame pointers
+	// look sane.  (debuginfo_eip panics on addresses below ULIM.)
+	for (ebp = (uint32_t *) cr->cr_ebp;
+	     ebp && (uintptr_t) ebp >= KERNBASE && !((uintptr_t) ebp & 3)
+		     && cr->cr_nframes < CRASH_NFRAMES;
+	     ebp = (uint32_t *) ebp[0]) {
+		cf = &cr->cr_frames[cr->cr_nframes++];
+		cf->cf_eip = ebp[1];
+		if (cf->cf_eip < ULIM || debuginfo_eip(cf->cf_eip, &info) < 0) {
+			strlcpy(cf->cf_fn, "<unknown>", sizeof(cf->cf_fn));
+			strlcpy(cf->cf_file, "<unknown>", sizeof(cf->cf_file));
+			continue;
+		}
+		strlcpy(cf->cf_fn, info.eip_fn_name,
+			MIN(info.eip_fn_namelen + 1, (int) sizeof(cf->cf_fn)));
+		strlcpy(cf->cf_file, info.eip_file, sizeof(cf->cf_file));
+		cf->cf_line = info.eip_line;
+	}
+
+	cr->cr_ntrace = trace_copy(cr->cr_trace, CRASH_NTRACE);
+
+	cr->cr_magic = CRASH_MAGIC;
+	cr->cr_sum = -crash_sum(cr);
+
+	crash_print_rec(cr, 0);
+	cprintf("Last kernel log records:\n");
+	klog_print(8);
+	cprintf("Crash record saved for the next boot\n");
+}
+
+// Report a crash record left by the previous boot, once.
+void
+crash_report(void)
+{
+	struct Crashrec *cr = CRASHREC;
+
+	static_assert(BOOTINFO_PADDR + sizeof(struct Bootinfo) <= CRASH_PADDR);
+	static_assert(CRASH_PADDR + sizeof(struct Crashrec) <= PGSIZE);
+
+	if (cr->cr_magic != CRASH_MAGIC || crash_sum(cr) != 0)
+		return;
+	lastcrash = *cr;
+	havecrash = 1;
+	cr->cr_magic = 0;
+
+	cprintf("Previous boot crashed ('crash' for details):\n");
+	cprintf("  kernel panic at %s:%d: %s\n",
+		lastcrash.cr_file, lastcrash.cr_line, lastcrash.cr_msg);
+}
+
+void
+crash_print(void)
+{
+	if (!havecrash)
+		cprintf("No crash record from the previous boot\n");
+	else
+		crash_print_rec(&lastcrash, 1);
+}
@@ -0,0 +1,57 @@
+#ifndef JOS_KERN_CRASH_H
+#define JOS_KERN_CRASH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/stdarg.h>
+#include <kern/trace.h>
+
+/*
+ * Panic flight recorder.  On a panic, the kernel prints what it knows
+ * about how it got there and also saves it in a crash record in page
+ * 0, above the boot info record.  Neither the BIOS nor the boot loader
+ * touches that memory on a warm reboot, so the next boot finds the
+ * record and reports the crash.  Everything in the record is copied
+ * out of the crashed kernel (names, messages), except trace payload
+ * pointers, which only mean something to the kernel that wrote them;
+ * a later boot prints those in hex.
+ */
+
+#define CRASH_PADDR	0x800
+#define CRASH_MAGIC	0xC4A5C4A5
+
+#define CRASH_NFRAMES	12	// Stack frames kept
+#define CRASH_NTRACE	16	// Trace events kept
+
+struct Crashframe {
+	uintptr_t cf_eip;
+	int cf_line;
+	char cf_fn[24];
+	char cf_file[24];
+};
+
+struct Crashrec {
+	uint32_t cr_magic;	// CRASH_MAGIC if the record is valid
+	uint32_t cr_sum;	// Makes the record's words sum to 0
+	uint64_t cr_tsc;	// When the kernel panicked
+	char cr_file[32];	// Where it panicked
+	int cr_line;
+	char cr_msg[128];	// What it said
+
+	// Registers at the panic
+	uint32_t cr_esp, cr_ebp, cr_eflags;
+	uint32_t cr_cr0, cr_cr2, cr_cr3, cr_cr4;
+
+	int cr_nframes;
+	struct Crashframe cr_frames[CRASH_NFRAMES];
+	int cr_ntrace;
+	struct Trace_rec cr_trace[CRASH_NTRACE];
+};
+
+void crash_panic(const char *file, int line, const char *fmt, va_list ap);
+void crash_report(void);
+void crash_print(void);
+
+#endif	// !JOS_KERN_CRASH_H
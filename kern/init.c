@@ -6,32 +6,74 @@
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/bootinfo.h>
+#include <kern/multiboot.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/klog.h>
+#include <kern/trace.h>
+#include <kern/crash.h>
+#include <kern/log.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
 test_backtrace(int x)
 {
-	cprintf("entering test_backtrace %d\n", x);
+	kdebug(LOG_KERN, "entering test_backtrace %d\n", x);
 	if (x > 0)
 		test_backtrace(x-1);
 	else
 		mon_backtrace(0, 0, 0);
-	cprintf("leaving test_backtrace %d\n", x);
+	kdebug(LOG_KERN, "leaving test_backtrace %d\n", x);
 }
 
 void
-i386_init(void)
+i386_init(uint32_t mbmagic, physaddr_t mbinfo)
 {
-    extern char edata[], end[];
+    extern char edata[], end[], etext[], erodata[];
+
+	// Timestamp the boot stages below (see kern/bootinfo.c).
+	boottime_reset();
 
 	// Before doing anything else, complete the ELF loading process.
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
+	boottime_stamp(BT_BSS);
 	memset(edata, 0, end - edata);
+	boottime_stamp(BT_BSS_DONE);
+
+	// String constants live in read-only data, so cprintf can cache
+	// their compiled formats.
+	printfmt_cache_init(etext, erodata);
+
+	// Save what a Multiboot loader told us before we overwrite it.
+	multiboot_init(mbmagic, mbinfo);
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
+	boottime_stamp(BT_CONS);
 	cons_init();
+	boottime_stamp(BT_CONS_DONE);
+	klog("i386_init: console up");
+
+	bootinfo_print();
+	multiboot_print();
+	crash_report();
+
+	// Lab 2 memory management initialization functions
+	mem_init();
+	kmem_init();
+	klog("i386_init: memory up");
+
+	// Lab 3 trap initialization functions
+	trap_init();
+
+	// Device interrupts; the console has already unmasked its IRQs
+	pic_init();
+	sti();
+	klog("i386_init: interrupts on");
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
@@ -62,6 +104,7 @@ _panic(const char *file, int line, const char *fmt,...)
 	if (panicstr)
 		goto dead;
 	panicstr = fmt;
+	TRACE(TR_PANIC, file, line, fmt);
 
 	// Be extra sure that the machine is in as reasonable state
 	asm volatile("cli; cld");
@@ -72,6 +115,11 @@ _panic(const char *file, int line, const char *fmt,...)
 	cprintf("\n");
 	va_end(ap);
 
+	// Explain, and leave a record for the next boot
+	va_start(ap, fmt);
+	crash_panic(file, line, fmt, ap);
+	va_end(ap);
+
 dead:
 	/* break into the kernel monitor */
 	while (1)
@@ -1,102 +1,155 @@
-#include <inc/stab.h>
+#include <inc/linetab.h>
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/kdebug.h>
+#include <kern/klog.h>
+#include <kern/trace.h>
 
-extern const struct Stab __STAB_BEGIN__[];	// Beginning of stabs table
-extern const struct Stab __STAB_END__[];	// End of stabs table
-extern const char __STABSTR_BEGIN__[];		// Beginning of string table
-extern const char __STABSTR_END__[];		// End of string table
+extern const char __LINETAB_BEGIN__[];	// Beginning of the line table
+extern const char __LINETAB_END__[];	// End of the line table
+extern const char etext[];
 
+// Direct-mapped cache of successful lookups, by eip.  Backtraces and
+// profilers look up the same few return addresses over and over.
+#define EIPCACHE_SIZE	64	// Must be a power of 2
 
-// stab_binsearch(stabs, region_left, region_right, type, addr)
-//
-//	Some stab types are arranged in increasing order by instruction
-//	address.  For example, N_FUN stabs (stab entries with n_type ==
-//	N_FUN), which mark functions, and N_SO stabs, which mark source files.
-//
-//	Given an instruction address, this function finds the single stab
-//	entry of type 'type' that contains that address.
-//
-//	The search takes place within the range [*region_left, *region_right].
-//	Thus, to search an entire set of N stabs, you might do:
-//
-//		left = 0;
-//		right = N - 1;     /* rightmost stab */
-//		stab_binsearch(stabs, &left, &right, type, addr);
-//
-//	The search modifies *region_left and *region_right to bracket the
-//	'addr'.  *region_left points to the matching stab that contains
-//	'addr', and *region_right points just before the next stab.  If
-//	*region_left > *region_right, then 'addr' is not contained in any
-//	matching stab.
-//
-//	For example, given these N_SO stabs:
-//		Index  Type   Address
-//		0      SO     f0100000
-//		13     SO     f0100040
-//		117    SO     f0100176
-//		118    SO     f0100178
-//		555    SO     f0100652
-//		556    SO     f0100654
-//		657    SO     f0100849
-//	this code:
-//		left = 0, right = 657;
-//		stab_binsearch(stabs, &left, &right, N_SO, 0xf0100184);
-//	will exit setting left = 118, right = 554.
-//
-// stabs是.stab段的起始位置, region_left,region_right是条目号
-// 该函数在[region_left,region_right]条目中找到类型为type, 且地址小于等于addr的最大条目行. 答案放在region_left中
-static void
-stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
-	       int type, uintptr_t addr)
+static struct Eipcache {
+	uintptr_t ec_eip;	// 0 if the slot is empty
+	struct Eipdebuginfo ec_info;
+} eipcache[EIPCACHE_SIZE];
+
+#define EIPCACHE_HASH(eip) \
+	(((eip) * 2654435761U) >> 16 & (EIPCACHE_SIZE - 1))
+
+// Return the kernel's line table, or NULL if it has none that fits
+// this kernel (as in the first of the build's two links).
+const struct Linetab *
+debuginfo_linetab(void)
 {
-	int l = *region_left, r = *region_right, any_matches = 0;
-
-	while (l <= r) {
-		int true_m = (l + r) / 2, m = true_m; // m为二分的中介点
-
-		// search for earliest stab with right type
-		while (m >= l && stabs[m].n_type != type)  // 地址只对同一类型有单调性, 找到最近的type类型
-			m--;
-		if (m < l) {	// no match in [l, m]
-			l = true_m + 1;
-			continue;
-		}
-
-		// actual binary search
-		any_matches = 1;    // 已经匹配了(找到了地址值小于等于eip的,类型为type的条目行)
-		if (stabs[m].n_value < addr) {
-			*region_left = m;
-			l = true_m + 1;
-		} else if (stabs[m].n_value > addr) {  // 说明第m+1个条目已经不在当前type的管辖范围了(地址更大), 那么大于等于m+1的条目就更不可能
-			*region_right = m - 1;
-			r = m - 1;
-		} else {
-			// exact match for 'addr', but continue loop to find
-			// *region_right
-            // 恰好找到了eip对应的type类型. 但是这里没有直接break, 为了继续缩小region_right.
-            // 作者的意思似乎是想二分到下一个type类型, 这样就可以把region_right固定在下一个type类型之前. (当然可以,虽然没意义,缩小边界使二分更快罢了)
-			*region_left = m;
-			l = m;
-			addr++;
-		}
+	const struct Linetab *lt = (const struct Linetab *) __LINETAB_BEGIN__;
+	size_t size = __LINETAB_END__ - __LINETAB_BEGIN__;
+
+	if (size < sizeof(*lt) || lt->lt_magic != LINETAB_MAGIC
+	    || lt->lt_size != size || lt->lt_etext != (uintptr_t) etext
+	    || lt->lt_str >= size || __LINETAB_BEGIN__[size - 1] != 0)
+		return NULL;
+	return lt;
+}
+
+static uint32_t
+get_uleb(const uint8_t **pp)
+{
+	const uint8_t *p = *pp;
+	uint32_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (uint32_t) (*p & 0x7F) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pp = p;
+	return v;
+}
+
+static int32_t
+get_sleb(const uint8_t **pp)
+{
+	const uint8_t *p = *pp;
+	uint32_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (uint32_t) (*p & 0x7F) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	if (shift < 32 && (p[-1] & 0x40))
+		v |= ~0U << shift;
+	*pp = p;
+	return v;
+}
+
+// Look addr up in the line table: a binary search for its range, then
+// a walk along that range's line program.
+static int
+debuginfo_linetab_find(const struct Linetab *lt, uintptr_t addr,
+		       struct Eipdebuginfo *info)
+{
+	const struct Linefun *lf = (const struct Linefun *) (lt + 1);
+	const char *str = (const char *) lt + lt->lt_str;
+	const uint8_t *p, *end;
+	uintptr_t a;
+	uint32_t op, file;
+	int l = 0, r = lt->lt_nfun + 1, line;
+
+	// Find the last range starting at or below addr
+	while (l < r) {
+		int m = (l + r) / 2;
+		if (lf[m].lf_addr <= addr)
+			l = m + 1;
+		else
+			r = m;
 	}
+	if (l == 0 || l > lt->lt_nfun || !lf[l - 1].lf_file)
+		return -1;
+	lf += l - 1;
 
-	if (!any_matches) // 没找到这样的条目行
-		*region_right = *region_left - 1;
-	else {
-		// find rightmost region containing 'addr'
-		for (l = *region_right;
-		     l > *region_left && stabs[l].n_type != type;
-		     l--)
-			/* do nothing */;
-		*region_left = l;
+	if (lf->lf_name) {
+		info->eip_fn_name = str + lf->lf_name;
+		info->eip_fn_namelen = strlen(info->eip_fn_name);
+		info->eip_fn_addr = lf->lf_addr;
+		info->eip_fn_narg = lf->lf_narg;
 	}
+
+	a = lf->lf_addr;
+	line = lf->lf_line;
+	file = lf->lf_file;
+	p = (const uint8_t *) lt + lt->lt_prog + lf[0].lf_prog;
+	end = (const uint8_t *) lt + lt->lt_prog + lf[1].lf_prog;
+	while (p < end) {
+		op = get_uleb(&p);
+		if ((a += op >> 1) > addr)
+			break;
+		if (op & 1)
+			file = get_uleb(&p);
+		line += get_sleb(&p);
+	}
+	info->eip_line = line;
+	info->eip_file = str + file;
+	return 0;
 }
 
+static bool
+eipcache_get(uintptr_t eip, struct Eipdebuginfo *info)
+{
+	struct Eipcache *ec = &eipcache[EIPCACHE_HASH(eip)];
+	uint32_t eflags;
+	bool hit;
+
+	// With interrupts off, so a lookup in an interrupt handler
+	// cannot refill the slot halfway through our copy.
+	eflags = read_eflags();
+	cli();
+	if ((hit = ec->ec_eip == eip))
+		*info = ec->ec_info;
+	write_eflags(eflags);
+	return hit;
+}
+
+static void
+eipcache_put(uintptr_t eip, const struct Eipdebuginfo *info)
+{
+	struct Eipcache *ec = &eipcache[EIPCACHE_HASH(eip)];
+	uint32_t eflags;
+
+	eflags = read_eflags();
+	cli();
+	ec->ec_eip = eip;
+	ec->ec_info = *info;
+	write_eflags(eflags);
+}
 
 // debuginfo_eip(addr, info)
 //
@@ -108,9 +161,7 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 {
-	const struct Stab *stabs, *stab_end;
-	const char *stabstr, *stabstr_end;
-	int lfile, rfile, lfun, rfun, lline, rline;
+	const struct Linetab *lt;
 
 	// Initialize *info
 	info->eip_file = "<unknown>";
@@ -120,93 +171,20 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_addr = addr;
 	info->eip_fn_narg = 0;
 
-	// Find the relevant set of stabs
-	if (addr >= ULIM) {
-		stabs = __STAB_BEGIN__;
-		stab_end = __STAB_END__;
-		stabstr = __STABSTR_BEGIN__;
-		stabstr_end = __STABSTR_END__;
-	} else {
-		// Can't search for user-level addresses yet!
-  	        panic("User address");
-	}
-
-	// String table validity checks
-	if (stabstr_end <= stabstr || stabstr_end[-1] != 0)
-		return -1;
-
-	// Now we find the right stabs that define the function containing
-	// 'eip'.  First, we find the basic source file containing 'eip'.
-	// Then, we look in that source file for the function.  Then we look
-	// for the line number.
+	// Can't search for user-level addresses yet!
+	if (addr < ULIM)
+		panic("User address");
 
-	// Search the entire set of stabs for the source file (type N_SO).
-	lfile = 0;
-	rfile = (stab_end - stabs) - 1;
-	stab_binsearch(stabs, &lfile, &rfile, N_SO, addr);
-	if (lfile == 0)
+	if (eipcache_get(addr, info))
+		goto found;
+	if ((lt = debuginfo_linetab()) == NULL
+	    || debuginfo_linetab_find(lt, addr, info) < 0) {
+		klog("debuginfo_eip %08x: no source file", addr);
+		TRACE(TR_DEBUGINFO, addr, 0, -1);
 		return -1;
-
-	// Search within that file's stabs for the function definition
-	// (N_FUN).
-	lfun = lfile;
-	rfun = rfile;
-	stab_binsearch(stabs, &lfun, &rfun, N_FUN, addr);
-
-	if (lfun <= rfun) {
-		// stabs[lfun] points to the function name
-		// in the string table, but check bounds just in case.
-		if (stabs[lfun].n_strx < stabstr_end - stabstr)
-			info->eip_fn_name = stabstr + stabs[lfun].n_strx; // 函数名
-		info->eip_fn_addr = stabs[lfun].n_value; // 函数入口地址
-		addr -= info->eip_fn_addr;  // 由于下面查找行号, 行号的n_value的函数内偏移地址, 所以减去.
-		// Search within the function definition for the line number.
-		lline = lfun;
-		rline = rfun;
-        stab_binsearch(stabs,&lline,&rline,N_SLINE,addr);
-        info->eip_line = stabs[lline].n_desc;
-	} else {
-		// Couldn't find function stab!  Maybe we're in an assembly
-		// file.  Search the whole file for the line number.
-		info->eip_fn_addr = addr;
-		lline = lfile;
-		rline = rfile;
 	}
-	// Ignore stuff after the colon.
-	info->eip_fn_namelen = strfind(info->eip_fn_name, ':') - info->eip_fn_name;
-
-
-	// Search within [lline, rline] for the line number stab.
-	// If found, set info->eip_line to the right line number.
-	// If not found, return -1.
-	//
-	// Hint:
-	//	There's a particular stabs type used for line numbers.
-	//	Look at the STABS documentation and <inc/stab.h> to find
-	//	which one.
-	// Your code here.
-
-
-	// Search backwards from the line number for the relevant filename
-	// stab.
-	// We can't just use the "lfile" stab because inlined functions
-	// can interpolate code from a different file!
-	// Such included source files use the N_SOL stab type.
-	while (lline >= lfile
-	       && stabs[lline].n_type != N_SOL
-	       && (stabs[lline].n_type != N_SO || !stabs[lline].n_value))
-		lline--;
-	if (lline >= lfile && stabs[lline].n_strx < stabstr_end - stabstr)
-		info->eip_file = stabstr + stabs[lline].n_strx;
-
-
-	// Set eip_fn_narg to the number of arguments taken by the function,
-	// or 0 if there was no containing function.
-	if (lfun < rfun)
-		for (lline = lfun + 1;
-		     lline < rfun && stabs[lline].n_type == N_PSYM;
-		     lline++)
-			info->eip_fn_narg++;
-
+	eipcache_put(addr, info);
+found:
+	TRACE(TR_DEBUGINFO, addr, info->eip_line, 0);
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define JOS_KERN_KDEBUG_H
 
 #include <inc/types.h>
+#include <inc/linetab.h>
 
 // Debug information about a particular instruction pointer
 struct Eipdebuginfo {
@@ -16,5 +17,6 @@ struct Eipdebuginfo {
 };
 
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+const struct Linetab *debuginfo_linetab(void);
 
 #endif
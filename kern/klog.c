@@ -0,0 +1,86 @@
+// Deferred kernel log: a ring of unformatted records.
+
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/klog.h>
+#include <kern/tsc.h>
+
+struct Klogrec {
+	uint32_t kr_seq;	// Record number + 1, or 0 while being written
+	const char *kr_fmt;
+	uint64_t kr_tsc;
+	uint32_t kr_words[KLOG_NWORDS];
+};
+
+// Writers claim a slot by bumping wpos atomically, so nested writers
+// (an interrupt handler logging in the middle of a klog) get slots of
+// their own, and nobody ever waits.  A slot's kr_seq is written last,
+// with release order, so a reader can tell a finished record from one
+// that is being written or has been reused.
+static struct {
+	uint32_t wpos;		// Records ever claimed
+	struct Klogrec recs[KLOG_SIZE];
+} klogbuf;
+
+// Log a message.  Reads KLOG_NWORDS words of arguments whether or not
+// the caller passed that many: on x86, the extra words are just the
+// caller's stack, and the format never looks at them.
+void
+klog(const char *fmt, ...)
+{
+	struct Klogrec *r;
+	uint32_t seq;
+	va_list ap;
+	int i;
+
+	seq = __atomic_fetch_add(&klogbuf.wpos, 1, __ATOMIC_RELAXED);
+	r = &klogbuf.recs[seq & (KLOG_SIZE - 1)];
+	__atomic_store_n(&r->kr_seq, 0, __ATOMIC_RELAXED);
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+	r->kr_fmt = fmt;
+	r->kr_tsc = read_tsc();
+	va_start(ap, fmt);
+	for (i = 0; i < KLOG_NWORDS; i++)
+		r->kr_words[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+
+	__atomic_store_n(&r->kr_seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Format and print the last n records (all of them, if n <= 0),
+// oldest first.
+void
+klog_print(int n)
+{
+	struct Klogrec rec;
+	uint32_t seq, end, start;
+	// Room past the words, in case a format wants more of them
+	uint32_t words[KLOG_NWORDS + 4];
+
+	end = __atomic_load_n(&klogbuf.wpos, __ATOMIC_ACQUIRE);
+	if (n <= 0 || n > KLOG_SIZE)
+		n = KLOG_SIZE;
+	start = end > (uint32_t) n ? end - n : 0;
+
+	for (seq = start; seq != end; seq++) {
+		struct Klogrec *r = &klogbuf.recs[seq & (KLOG_SIZE - 1)];
+
+		if (__atomic_load_n(&r->kr_seq, __ATOMIC_ACQUIRE) != seq + 1)
+			continue;
+		rec = *r;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->kr_seq, __ATOMIC_ACQUIRE) != seq + 1)
+			continue;	// Overwritten while we copied it
+
+		memset(words, 0, sizeof(words));
+		memcpy(words, rec.kr_words, sizeof(rec.kr_words));
+		cprintf("[%10llu] ", tsc_to_us(rec.kr_tsc));
+		// An i386 va_list is just a pointer to the argument words
+		vcprintf(rec.kr_fmt, (va_list) words);
+		cprintf("\n");
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef JOS_KERN_KLOG_H
+#define JOS_KERN_KLOG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Deferred kernel log.  klog() records its format pointer, the TSC,
+// and its argument words, and formats nothing; dmesg formats the
+// records later.  So the format and any %s arguments must be string
+// constants, and at most KLOG_NWORDS words of arguments are kept
+// (a %llu takes two).
+
+#define KLOG_NWORDS	6	// Argument words kept per record
+#define KLOG_SIZE	256	// Records in the ring; must be a power of 2
+
+void klog(const char *fmt, ...);
+void klog_print(int n);
+
+#endif	// !JOS_KERN_KLOG_H
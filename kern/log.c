@@ -0,0 +1,61 @@
+// Run-time filtering for the leveled console messages in kern/log.h.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+
+#include <kern/log.h>
+
+uint8_t log_levels[LOG_NSUBSYS];
+
+static const char * const log_names[LOG_NSUBSYS] = {
+	[LOG_KERN] = "kern",
+	[LOG_CONS] = "cons",
+	[LOG_MEM] = "mem",
+	[LOG_TRAP] = "trap",
+};
+
+static const char * const level_names[] = {
+	[LOG_DEBUG] = "debug",
+	[LOG_INFO] = "info",
+	[LOG_WARN] = "warn",
+	[LOG_NONE] = "none",
+};
+
+// Set the run-time level of subsystem sys, or of every subsystem if
+// sys is "all".  Messages the build compiled out stay out whatever the
+// level says.
+int
+log_set(const char *sys, const char *level)
+{
+	int i, lv;
+
+	for (lv = 0; lv < ARRAY_SIZE(level_names); lv++)
+		if (strcmp(level, level_names[lv]) == 0)
+			break;
+	if (lv == ARRAY_SIZE(level_names))
+		return -E_INVAL;
+
+	if (strcmp(sys, "all") == 0) {
+		for (i = 0; i < LOG_NSUBSYS; i++)
+			log_levels[i] = lv;
+		return 0;
+	}
+	for (i = 0; i < LOG_NSUBSYS; i++)
+		if (strcmp(sys, log_names[i]) == 0) {
+			log_levels[i] = lv;
+			return 0;
+		}
+	return -E_INVAL;
+}
+
+void
+log_print(void)
+{
+	int i;
+
+	cprintf("compiled in: %s and up\n", level_names[LOG_LEVEL]);
+	for (i = 0; i < LOG_NSUBSYS; i++)
+		cprintf("  %-6s %s\n", log_names[i],
+			level_names[MAX(log_levels[i], LOG_LEVEL)]);
+}
@@ -0,0 +1,60 @@
+#ifndef JOS_KERN_LOG_H
+#define JOS_KERN_LOG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+// Leveled console messages.
+//
+//	kdebug(LOG_MEM, "freed %d pages\n", n);
+//	kinfo(LOG_CONS, "serial: %u baud\n", baud);
+//	kwarn(LOG_TRAP, "spurious interrupt on irq %d", irq);
+//
+// kdebug and kinfo print with cprintf, kwarn with _warn (so it gets a
+// file and line and needs no newline).  Messages below the build's
+// LOG_LEVEL (LOG_LEVEL=DEBUG|INFO|WARN|NONE in conf/env.mk, default
+// INFO) are compiled out: the call sits behind a constant-false test,
+// so its arguments are never evaluated and no code is emitted.  The
+// rest can also be silenced per subsystem at run time with the
+// monitor's "log" command.
+
+#define LOG_DEBUG	0
+#define LOG_INFO	1
+#define LOG_WARN	2
+#define LOG_NONE	3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL	LOG_INFO
+#endif
+
+// Subsystems.  Keep log_names in kern/log.c in step.
+enum {
+	LOG_KERN = 0,	// startup and anything without a better home
+	LOG_CONS,	// console devices
+	LOG_MEM,	// physical memory and kmalloc
+	LOG_TRAP,	// traps and interrupts
+	LOG_NSUBSYS
+};
+
+// Lowest level each subsystem prints at run time
+extern uint8_t log_levels[LOG_NSUBSYS];
+
+#define log_enabled(level, sys) \
+	((level) >= LOG_LEVEL && (level) >= log_levels[sys])
+
+#define kdebug(sys, ...) \
+	do { if (log_enabled(LOG_DEBUG, sys)) cprintf(__VA_ARGS__); } while (0)
+#define kinfo(sys, ...) \
+	do { if (log_enabled(LOG_INFO, sys)) cprintf(__VA_ARGS__); } while (0)
+#define kwarn(sys, ...) \
+	do { if (log_enabled(LOG_WARN, sys)) \
+		_warn(__FILE__, __LINE__, __VA_ARGS__); } while (0)
+
+int log_set(const char *sys, const char *level);
+void log_print(void);
+
+#endif	// !JOS_KERN_LOG_H
@@ -0,0 +1,333 @@
+/*
+ * Build the kernel's address-to-line table (see inc/linetab.h) from
+ * the stabs of a kernel ELF.
+ *
+ * This is a host program: it runs at build time, not in JOS.
+ *
+ *	mklinetab kernel linetab
+ *
+ * Only function ranges, parameter counts and line numbers are kept;
+ * the type stabs, which are most of the stabs, are dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Use the host's integer types instead of JOS's
+#define JOS_INC_TYPES_H
+#include <inc/elf.h>
+#include <inc/linetab.h>
+// The kernel's stabs hold 32-bit addresses, whatever the host's are
+#define uintptr_t uint32_t
+#include <inc/stab.h>
+#undef uintptr_t
+
+struct range {
+	uint32_t addr;
+	uint32_t seq;		// Order of appearance, to keep sorts stable
+	uint32_t name, file;	// Offsets into strtab
+	uint32_t line, narg;
+	uint32_t nlines;
+	struct line *lines;
+};
+
+struct line {
+	uint32_t addr, seq;
+	uint32_t line, file;
+};
+
+static struct range *ranges;
+static uint32_t nranges;
+static char *strtab;
+static uint32_t strsize;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+	if ((p = realloc(p, n)) == NULL) {
+		fprintf(stderr, "mklinetab: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+// Add the string s[0, n) to strtab, if it is not there already, and
+// return its offset.
+static uint32_t
+addstr(const char *s, size_t n)
+{
+	uint32_t off;
+
+	if (n == 0)
+		return 0;
+	for (off = 1; off < strsize; off += strlen(strtab + off) + 1)
+		if (strlen(strtab + off) == n && memcmp(strtab + off, s, n) == 0)
+			return off;
+	strtab = xrealloc(strtab, strsize + n + 1);
+	memcpy(strtab + strsize, s, n);
+	strtab[strsize + n] = 0;
+	strsize += n + 1;
+	return off;
+}
+
+static struct range *
+addrange(uint32_t addr, uint32_t name, uint32_t file, uint32_t line)
+{
+	struct range *r;
+
+	ranges = xrealloc(ranges, (nranges + 1) * sizeof(*ranges));
+	r = &ranges[nranges];
+	memset(r, 0, sizeof(*r));
+	r->addr = addr;
+	r->seq = nranges++;
+	r->name = name;
+	r->file = file;
+	r->line = line;
+	return r;
+}
+
+static int
+cmp_range(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+
+	if (ra->addr != rb->addr)
+		return ra->addr < rb->addr ? -1 : 1;
+	return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+static int
+cmp_line(const void *a, const void *b)
+{
+	const struct line *la = a, *lb = b;
+
+	if (la->addr != lb->addr)
+		return la->addr < lb->addr ? -1 : 1;
+	return la->seq < lb->seq ? -1 : la->seq > lb->seq;
+}
+
+static uint8_t *
+put_uleb(uint8_t *p, uint32_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		*p++ = v | 0x80;
+	*p++ = v;
+	return p;
+}
+
+static uint8_t *
+put_sleb(uint8_t *p, int32_t v)
+{
+	for (; v < -0x40 || v >= 0x40; v >>= 7)
+		*p++ = (v & 0x7F) | 0x80;
+	*p++ = v & 0x7F;
+	return p;
+}
+
+static const struct Secthdr *
+find_section(const uint8_t *elf, const char *name)
+{
+	const struct Elf *eh = (const struct Elf *) elf;
+	const struct Secthdr *sh = (const struct Secthdr *) (elf + eh->e_shoff);
+	const char *shstr = (const char *) elf + sh[eh->e_shstrndx].sh_offset;
+	int i;
+
+	for (i = 0; i < eh->e_shnum; i++)
+		if (strcmp(shstr + sh[i].sh_name, name) == 0)
+			return &sh[i];
+	return NULL;
+}
+
+// Turn the stabs into ranges and line entries.  Line stabs inside a
+// function hold offsets from its start; those in assembly files, which
+// have no function stabs, are absolute.
+static void
+read_stabs(const struct Stab *stabs, uint32_t nstabs, const char *stabstr)
+{
+	struct range *cur = NULL;
+	struct line *l;
+	uint32_t i, file = 0, base = 0;
+	const char *s;
+
+	for (i = 0; i < nstabs; i++) {
+		s = stabstr + stabs[i].n_strx;
+		switch (stabs[i].n_type) {
+		case N_SO:
+			// An unnamed N_SO marks the end of a file's code
+			file = addstr(s, strlen(s));
+			cur = addrange(stabs[i].n_value, 0, file, 0);
+			base = 0;
+			break;
+		case N_SOL:
+			file = addstr(s, strlen(s));
+			break;
+		case N_FUN:
+			if (!*s) {
+				// The end of a function, in some compilers
+				cur = addrange(base + stabs[i].n_value, 0, 0, 0);
+				break;
+			}
+			cur = addrange(stabs[i].n_value,
+				       addstr(s, strcspn(s, ":")), file,
+				       stabs[i].n_desc);
+			base = stabs[i].n_value;
+			break;
+		case N_PSYM:
+			if (cur && cur->name)
+				cur->narg++;
+			break;
+		case N_SLINE:
+			if (!cur || !cur->file)
+				break;
+			cur->lines = xrealloc(cur->lines,
+				(cur->nlines + 1) * sizeof(*cur->lines));
+			l = &cur->lines[cur->nlines];
+			l->addr = base + stabs[i].n_value;
+			l->seq = cur->nlines++;
+			l->line = stabs[i].n_desc;
+			l->file = file;
+			break;
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *in, *out;
+	uint8_t *elf, *prog, *p;
+	long elfsize;
+	const struct Secthdr *text, *stab, *stabstr;
+	struct Linetab lt;
+	struct Linefun *funs;
+	struct range *r;
+	struct line *l;
+	uint32_t i, j, n, nfun, addr, line, file;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: mklinetab kernel linetab\n");
+		return 1;
+	}
+
+	if ((in = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(in, 0, SEEK_END);
+	elfsize = ftell(in);
+	rewind(in);
+	elf = xrealloc(NULL, elfsize);
+	if (fread(elf, 1, elfsize, in) != elfsize) {
+		perror(argv[1]);
+		return 1;
+	}
+	fclose(in);
+
+	if (((struct Elf *) elf)->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		return 1;
+	}
+	text = find_section(elf, ".text");
+	stab = find_section(elf, ".stab");
+	stabstr = find_section(elf, ".stabstr");
+	if (!text) {
+		fprintf(stderr, "%s: no .text\n", argv[1]);
+		return 1;
+	}
+	if (!stab || !stabstr)
+		fprintf(stderr, "%s: no stabs, so the line table is empty\n",
+			argv[1]);
+
+	strtab = xrealloc(NULL, 1);
+	strtab[0] = 0;
+	strsize = 1;
+	memset(&lt, 0, sizeof(lt));
+	lt.lt_magic = LINETAB_MAGIC;
+	lt.lt_etext = text->sh_addr + text->sh_size;
+	if (stab && stabstr)
+		read_stabs((struct Stab *) (elf + stab->sh_offset),
+			   stab->sh_size / sizeof(struct Stab),
+			   (char *) elf + stabstr->sh_offset);
+
+	// Sort the ranges, drop empty ones (a C file's own range, which
+	// starts where its first function does), and end with a gap.
+	qsort(ranges, nranges, sizeof(*ranges), cmp_range);
+	for (i = n = 0; i < nranges; i++)
+		if (i + 1 == nranges || ranges[i].addr != ranges[i + 1].addr)
+			ranges[n++] = ranges[i];
+	nranges = n;
+	if (nranges == 0 || ranges[nranges - 1].file)
+		addrange(lt.lt_etext, 0, 0, 0);
+	nfun = nranges - 1;
+
+	// Each line entry takes at most 5 + 5 + 5 bytes.
+	for (i = n = 0; i < nranges; i++)
+		n += ranges[i].nlines;
+	prog = p = xrealloc(NULL, n * 15 + 1);
+	funs = xrealloc(NULL, nranges * sizeof(*funs));
+	for (i = 0; i < nranges; i++) {
+		r = &ranges[i];
+		if (r->name >= 0x10000 || r->file >= 0x10000
+		    || r->line >= 0x10000 || r->narg >= 0x100) {
+			fprintf(stderr, "%s: line table overflow\n", argv[1]);
+			return 1;
+		}
+		funs[i].lf_addr = r->addr;
+		funs[i].lf_prog = p - prog;
+		funs[i].lf_name = r->name;
+		funs[i].lf_file = r->file;
+		funs[i].lf_line = r->line;
+		funs[i].lf_narg = r->narg;
+		funs[i].lf_pad = 0;
+
+		qsort(r->lines, r->nlines, sizeof(*r->lines), cmp_line);
+		addr = r->addr;
+		line = r->line;
+		file = r->file;
+		for (j = 0; j < r->nlines; j++) {
+			l = &r->lines[j];
+			// Of several entries at one address, the last counts
+			if (j + 1 < r->nlines && r->lines[j + 1].addr == l->addr)
+				continue;
+			if (l->addr < r->addr || l->line >= 0x10000) {
+				fprintf(stderr, "%s: bad line stab at %08x\n",
+					argv[1], l->addr);
+				return 1;
+			}
+			p = put_uleb(p, (l->addr - addr) << 1 | (l->file != file));
+			if (l->file != file)
+				p = put_uleb(p, l->file);
+			p = put_sleb(p, (int32_t) l->line - (int32_t) line);
+			addr = l->addr;
+			line = l->line;
+			file = l->file;
+			lt.lt_nline++;
+		}
+	}
+
+	lt.lt_nfun = nfun;
+	lt.lt_prog = sizeof(lt) + nranges * sizeof(*funs);
+	lt.lt_str = lt.lt_prog + (p - prog);
+	lt.lt_size = lt.lt_str + strsize;
+
+	if ((out = fopen(argv[2], "wb")) == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+	fwrite(&lt, sizeof(lt), 1, out);
+	fwrite(funs, sizeof(*funs), nranges, out);
+	fwrite(prog, 1, p - prog, out);
+	fwrite(strtab, 1, strsize, out);
+	if (fclose(out) != 0) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	fprintf(stderr, "%s: %u bytes of stabs -> %u bytes,"
+		" %u ranges, %u line entries\n", argv[2],
+		stab && stabstr ? stab->sh_size + stabstr->sh_size : 0,
+		lt.lt_size, nfun, lt.lt_nline);
+	return 0;
+}
@@ -4,12 +4,22 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/memlayout.h>
+#include <inc/mmu.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+#include <kern/multiboot.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/klog.h>
+#include <kern/trace.h>
+#include <kern/crash.h>
+#include <kern/log.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,6 +34,22 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "boottime", "Display where boot time went", mon_boottime },
+	{ "pgsize", "Display the page sizes mapping the address space", mon_pgsize },
+	{ "memmap", "Display the physical memory map from the boot loader", mon_memmap },
+	{ "meminfo", "Display free physical memory by block size", mon_meminfo },
+	{ "slabinfo", "Display kernel object cache statistics", mon_slabinfo },
+	{ "pgebench", "Time address space switches with and without global pages", mon_pgebench },
+	{ "baud", "Display or set the serial port speed", mon_baud },
+	{ "cons", "Display console outputs, or turn one on or off", mon_cons },
+	{ "consin", "Display console input counts, drops, and overruns", mon_consin },
+	{ "fmtcache", "Display printf format cache statistics", mon_fmtcache },
+	{ "fmtbench", "Time printf with and without the format cache", mon_fmtbench },
+	{ "dmesg", "Display the deferred kernel log", mon_dmesg },
+	{ "trace", "Display recent trace events, optionally only some", mon_trace },
+	{ "crash", "Display the previous boot's crash record", mon_crash },
+	{ "reboot", "Warm boot by a port 0x92 fast reset, keeping any crash record", mon_reboot },
+	{ "log", "Display or set console message levels", mon_log },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -42,6 +68,7 @@ int
 mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 {
 	extern char _start[], entry[], etext[], edata[], end[];
+	const struct Linetab *lt;
 
 	cprintf("Special kernel symbols:\n");
 	cprintf("  _start                  %08x (phys)\n", _start);
@@ -51,6 +78,11 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		ROUNDUP(end - entry, 1024) / 1024);
+	if ((lt = debuginfo_linetab()) != NULL)
+		cprintf("Kernel line table: %d bytes, %d ranges, %d lines\n",
+			lt->lt_size, lt->lt_nfun, lt->lt_nline);
+	else
+		cprintf("Kernel line table: none\n");
 	return 0;
 }
 
@@ -82,6 +114,298 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 }
 
 
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	cprintf("Boot timeline (TSC at %llu Hz):\n", tsc_freq());
+	boottime_print(0);
+	return 0;
+}
+
+
+// Print one run of page directory entries [start, end) that share a
+// mapping granularity.
+static void
+pgsize_run(uint32_t start, uint32_t end, pde_t pde)
+{
+	cprintf("  %08x-%08x  ", start << PDXSHIFT,
+		(end << PDXSHIFT) - 1);
+	if (pde & PTE_PS)
+		cprintf("%4u x 4MB pages  -> %08x%s\n", end - start,
+			PTE_ADDR(pde), pde & PTE_G ? "  global" : "");
+	else
+		cprintf("%4u page tables (4KB pages)\n", end - start);
+}
+
+int
+mon_pgsize(int argc, char **argv, struct Trapframe *tf)
+{
+	pde_t *pgdir = (pde_t *) (KERNBASE + PTE_ADDR(rcr3()));
+	uint32_t i, j;
+
+	cprintf("Page size extensions (CR4.PSE): %s, global pages (CR4.PGE): %s\n",
+		rcr4() & CR4_PSE ? "on" : "off",
+		rcr4() & CR4_PGE ? "on" : "off");
+	cprintf("Page directory at %08x (phys):\n", PTE_ADDR(rcr3()));
+	for (i = 0; i < NPDENTRIES; i = j) {
+		// Extend the run while the entries are the same kind and,
+		// for large pages, physically contiguous.
+		for (j = i + 1; j < NPDENTRIES; j++) {
+			if ((pgdir[j] & (PTE_P|PTE_PS|PTE_G))
+			    != (pgdir[i] & (PTE_P|PTE_PS|PTE_G)))
+				break;
+			if ((pgdir[i] & PTE_PS) && PTE_ADDR(pgdir[j])
+			    != PTE_ADDR(pgdir[i]) + ((j - i) << PDXSHIFT))
+				break;
+		}
+		if (pgdir[i] & PTE_P)
+			pgsize_run(i, j, pgdir[i]);
+	}
+	return 0;
+}
+
+int
+mon_memmap(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Memregion *mr;
+	uint64_t avail = 0;
+	int i;
+
+	if (!bootparams.bp_multiboot || bootparams.bp_nmemmap == 0) {
+		cprintf("No memory map (not booted by a Multiboot loader)\n");
+		return 0;
+	}
+	for (i = 0; i < bootparams.bp_nmemmap; i++) {
+		mr = &bootparams.bp_memmap[i];
+		cprintf("  %016llx-%016llx  %s\n", mr->mr_addr,
+			mr->mr_addr + mr->mr_len - 1, memmap_type(mr->mr_type));
+		if (mr->mr_type == MULTIBOOT_MEMORY_AVAILABLE)
+			avail += mr->mr_len;
+	}
+	cprintf("Available: %lluKB\n", avail >> 10);
+	return 0;
+}
+
+int
+mon_meminfo(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Meminfo mi;
+	int o, frag;
+
+	page_meminfo(&mi);
+	cprintf("%u of %u pages free (%uK)\n", mi.mi_nfree, mi.mi_npages,
+		mi.mi_nfree * (PGSIZE / 1024));
+	cprintf("  order  block  free blocks  free pages  frag index\n");
+	for (o = 0; o < PAGE_NORDERS; o++) {
+		frag = page_frag_index(&mi, o);
+		cprintf("  %5d  %4uK  %11u  %10u  %6d.%03d\n", o,
+			(PGSIZE / 1024) << o, mi.mi_nblocks[o],
+			mi.mi_nblocks[o] << o, frag / 1000, frag % 1000);
+	}
+	cprintf("Zeroed page pool: %u/%u pages (filled with %s), "
+		"%u hits, %u misses, %llu cycles saved\n",
+		mi.mi_zpool, mi.mi_zpool_max,
+		mi.mi_zpool_nt ? "movnti" : "rep stosl",
+		mi.mi_zhits, mi.mi_zmisses, mi.mi_zsaved);
+	return 0;
+}
+
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_print_stats();
+	return 0;
+}
+
+int
+mon_pgebench(int argc, char **argv, struct Trapframe *tf)
+{
+	int nswitch = 10000, ntouch = 16;
+	uint64_t with, without;
+
+	if (argc > 1)
+		nswitch = strtol(argv[1], NULL, 0);
+	if (argc > 2)
+		ntouch = strtol(argv[2], NULL, 0);
+	if (nswitch <= 0 || ntouch < 0) {
+		cprintf("Usage: pgebench [switches [4MB pages touched]]\n");
+		return 0;
+	}
+
+	// Warm up, then measure each way
+	pmap_switch_bench(1, nswitch / 10 + 1, ntouch);
+	with = pmap_switch_bench(1, nswitch, ntouch);
+	without = pmap_switch_bench(0, nswitch, ntouch);
+	cprintf("%d cr3 switches touching %d kernel 4MB pages:\n",
+		nswitch, ntouch);
+	cprintf("  with PGE     %6llu cycles/switch\n", with);
+	cprintf("  without PGE  %6llu cycles/switch\n", without);
+	if (with)
+		cprintf("  global pages save %llu%%\n",
+			without > with ? (without - with) * 100 / without : 0);
+	return 0;
+}
+
+int
+mon_baud(int argc, char **argv, struct Trapframe *tf)
+{
+	if (!serial_get_baud()) {
+		cprintf("No serial port\n");
+		return 0;
+	}
+	if (argc > 1 && serial_set_baud(strtol(argv[1], NULL, 10)) < 0)
+		cprintf("Usage: baud [rate], where rate divides 115200\n");
+	cprintf("Serial port at %u baud\n", serial_get_baud());
+	return 0;
+}
+
+int
+mon_cons(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 3 && (strcmp(argv[2], "on") == 0
+			  || strcmp(argv[2], "off") == 0)) {
+		if (cons_sink_enable(argv[1], strcmp(argv[2], "on") == 0) < 0)
+			cprintf("No console output '%s'\n", argv[1]);
+	} else if (argc != 1) {
+		cprintf("Usage: cons [output on|off]\n");
+		return 0;
+	}
+	cons_sink_print();
+	return 0;
+}
+
+int
+mon_consin(int argc, char **argv, struct Trapframe *tf)
+{
+	cons_input_print();
+	return 0;
+}
+
+int
+mon_fmtcache(int argc, char **argv, struct Trapframe *tf)
+{
+	unsigned hits, misses, bypasses;
+
+	printfmt_cache_stats(&hits, &misses, &bypasses);
+	cprintf("Format cache: %u hits, %u misses, %u bypasses\n",
+		hits, misses, bypasses);
+	if (hits + misses)
+		cprintf("  %u%% of cacheable formats hit\n",
+			hits * 100 / (hits + misses));
+	return 0;
+}
+
+// Format a backtrace line 'n' times; returns cycles per line.
+static uint64_t
+fmtbench(int n)
+{
+	char buf[128];
+	uint64_t start;
+	int i;
+
+	start = read_tsc();
+	for (i = 0; i < n; i++)
+		snprintf(buf, sizeof(buf),
+			 "  ebp %08x  eip %08x  args %08x %08x %08x %08x %08x\n",
+			 i, i, i, i, i, i, i);
+	return (read_tsc() - start) / n;
+}
+
+int
+mon_fmtbench(int argc, char **argv, struct Trapframe *tf)
+{
+	int n = 10000, was;
+	uint64_t cached, parsed;
+
+	if (argc > 1)
+		n = strtol(argv[1], NULL, 0);
+	if (n <= 0) {
+		cprintf("Usage: fmtbench [lines]\n");
+		return 0;
+	}
+
+	// Warm up, then measure each way
+	was = printfmt_cache_enable(1);
+	fmtbench(n / 10 + 1);
+	cached = fmtbench(n);
+	printfmt_cache_enable(0);
+	parsed = fmtbench(n);
+	printfmt_cache_enable(was);
+
+	cprintf("%d backtrace lines formatted:\n", n);
+	cprintf("  compiled format  %6llu cycles/line\n", cached);
+	cprintf("  parsed format    %6llu cycles/line\n", parsed);
+	if (parsed)
+		cprintf("  the cache saves %llu%%\n",
+			parsed > cached ? (parsed - cached) * 100 / parsed : 0);
+	return 0;
+}
+
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 2) {
+		cprintf("Usage: dmesg [records]\n");
+		return 0;
+	}
+	klog_print(argc > 1 ? strtol(argv[1], NULL, 0) : 0);
+	return 0;
+}
+
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf)
+{
+	uint32_t mask = 0;
+	int i, n = 0, id;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] >= '0' && argv[i][0] <= '9')
+			n = strtol(argv[i], NULL, 0);
+		else if ((id = trace_event_id(argv[i])) > 0)
+			mask |= 1 << id;
+		else {
+			cprintf("Usage: trace [records] [event...]\n");
+			cprintf("Events: cons_intr runcmd debuginfo panic\n");
+			return 0;
+		}
+	}
+	trace_print(n, mask ? mask : ~0);
+	return 0;
+}
+
+
+int
+mon_crash(int argc, char **argv, struct Trapframe *tf)
+{
+	crash_print();
+	return 0;
+}
+
+int
+mon_reboot(int argc, char **argv, struct Trapframe *tf)
+{
+	cprintf("Rebooting!\n");
+	serial_flush();
+	// Fast reset: bit 0 of system control port A (0x92) pulses the
+	// CPU's reset line.  The BIOS does a warm boot, which skips the
+	// memory test and leaves low memory (and the crash record) alone,
+	// only because entry.S wrote 0x1234 to the reset flag at 0x472.
+	outb(0x92, 0x3);
+	return 0;
+}
+
+int
+mon_log(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 3 && log_set(argv[1], argv[2]) == 0)
+		return 0;
+	if (argc != 1) {
+		cprintf("Usage: log [subsystem|all debug|info|warn|none]\n");
+		return 0;
+	}
+	log_print();
+	return 0;
+}
 
 /***** Kernel monitor command interpreter *****/
 
@@ -119,6 +443,8 @@ runcmd(char *buf, struct Trapframe *tf)
 	// Lookup and invoke the command
 	if (argc == 0)
 		return 0;
+	TRACE(TR_RUNCMD, argc, trace_strword(argv[0], 0),
+	      trace_strword(argv[0], 1));
 	for (i = 0; i < ARRAY_SIZE(commands); i++) {
 		if (strcmp(argv[0], commands[i].name) == 0)
 			return commands[i].func(argc, argv, tf);
@@ -137,6 +463,7 @@ monitor(struct Trapframe *tf)
     cprintf("6828 decimal is 15254 octal!\n");
 
 	while (1) {
+		boottime_prompt();
 		buf = readline("K> ");
 		if (buf != NULL)
 			if (runcmd(buf, tf) < 0)
@@ -15,5 +15,21 @@ void monitor(struct Trapframe *tf);
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_boottime(int argc, char **argv, struct Trapframe *tf);
+int mon_pgsize(int argc, char **argv, struct Trapframe *tf);
+int mon_memmap(int argc, char **argv, struct Trapframe *tf);
+int mon_meminfo(int argc, char **argv, struct Trapframe *tf);
+int mon_slabinfo(int argc, char **argv, struct Trapframe *tf);
+int mon_pgebench(int argc, char **argv, struct Trapframe *tf);
+int mon_baud(int argc, char **argv, struct Trapframe *tf);
+int mon_cons(int argc, char **argv, struct Trapframe *tf);
+int mon_consin(int argc, char **argv, struct Trapframe *tf);
+int mon_fmtcache(int argc, char **argv, struct Trapframe *tf);
+int mon_fmtbench(int argc, char **argv, struct Trapframe *tf);
+int mon_dmesg(int argc, char **argv, struct Trapframe *tf);
+int mon_trace(int argc, char **argv, struct Trapframe *tf);
+int mon_crash(int argc, char **argv, struct Trapframe *tf);
+int mon_reboot(int argc, char **argv, struct Trapframe *tf);
+int mon_log(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
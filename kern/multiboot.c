@@ -0,0 +1,109 @@
+// Direct boot by a Multiboot loader (e.g., "qemu -kernel").
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/multiboot.h>
+#include <kern/log.h>
+
+// entry_pgdir maps physical [0, 256MB) at KERNBASE; that is all we
+// can look at this early.
+#define MB_MAPPED	0x10000000
+
+struct Bootparams bootparams;
+
+// Return a kernel virtual address for 'len' bytes at physical address
+// 'pa', or NULL if the loader handed us something we cannot reach.
+static void *
+mb_kaddr(physaddr_t pa, size_t len)
+{
+	if (pa >= MB_MAPPED || len > MB_MAPPED - pa)
+		return NULL;
+	return (void *) (KERNBASE + pa);
+}
+
+// Copy a loader string into 'dst' (of size 'size').
+static void
+mb_string(char *dst, physaddr_t pa, size_t size)
+{
+	const char *s;
+
+	if ((s = mb_kaddr(pa, size)) != NULL)
+		strlcpy(dst, s, size);
+}
+
+// Parse the Multiboot info block at physical address 'info' into
+// bootparams.  'magic' is what the loader left in %eax; anything but
+// MULTIBOOT_BOOTLOADER_MAGIC means we came from boot/main.c and there
+// is no info block.  This runs before cons_init, so it cannot print.
+void
+multiboot_init(uint32_t magic, physaddr_t info)
+{
+	struct Multiboot_info *mbi;
+	struct Multiboot_mmap *mm;
+	uint32_t off;
+
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC
+	    || (mbi = mb_kaddr(info, sizeof(*mbi))) == NULL)
+		return;
+
+	bootparams.bp_multiboot = 1;
+	bootparams.bp_flags = mbi->mb_flags;
+
+	if (mbi->mb_flags & MULTIBOOT_INFO_MEMORY) {
+		bootparams.bp_mem_lower = mbi->mb_mem_lower;
+		bootparams.bp_mem_upper = mbi->mb_mem_upper;
+	}
+	if (mbi->mb_flags & MULTIBOOT_INFO_CMDLINE)
+		mb_string(bootparams.bp_cmdline, mbi->mb_cmdline,
+			  sizeof(bootparams.bp_cmdline));
+	if (mbi->mb_flags & MULTIBOOT_INFO_LOADER_NAME)
+		mb_string(bootparams.bp_loader, mbi->mb_loader_name,
+			  sizeof(bootparams.bp_loader));
+
+	if (!(mbi->mb_flags & MULTIBOOT_INFO_MEM_MAP)
+	    || !mb_kaddr(mbi->mb_mmap_addr, mbi->mb_mmap_length))
+		return;
+	for (off = 0; off + sizeof(*mm) <= mbi->mb_mmap_length;
+	     off += mm->mm_size + sizeof(mm->mm_size)) {
+		mm = mb_kaddr(mbi->mb_mmap_addr + off, sizeof(*mm));
+		if (bootparams.bp_nmemmap == MEMMAP_MAX)
+			break;
+		bootparams.bp_memmap[bootparams.bp_nmemmap].mr_addr = mm->mm_addr;
+		bootparams.bp_memmap[bootparams.bp_nmemmap].mr_len = mm->mm_len;
+		bootparams.bp_memmap[bootparams.bp_nmemmap].mr_type = mm->mm_type;
+		bootparams.bp_nmemmap++;
+	}
+}
+
+const char *
+memmap_type(uint32_t type)
+{
+	static const char * const names[] = {
+		[MULTIBOOT_MEMORY_AVAILABLE]	= "available",
+		[MULTIBOOT_MEMORY_RESERVED]	= "reserved",
+		[MULTIBOOT_MEMORY_ACPI]		= "ACPI data",
+		[MULTIBOOT_MEMORY_NVS]		= "ACPI NVS",
+		[MULTIBOOT_MEMORY_BADRAM]	= "bad RAM",
+	};
+
+	if (type < ARRAY_SIZE(names) && names[type])
+		return names[type];
+	return "unknown";
+}
+
+// Report how we were booted, if it was by a Multiboot loader.
+void
+multiboot_print(void)
+{
+	if (!bootparams.bp_multiboot)
+		return;
+	kinfo(LOG_KERN, "multiboot: booted by %s, %uKB low + %uKB high memory, "
+		"%d memory map entries\n",
+		bootparams.bp_loader[0] ? bootparams.bp_loader : "unknown loader",
+		bootparams.bp_mem_lower, bootparams.bp_mem_upper,
+		bootparams.bp_nmemmap);
+	if (bootparams.bp_cmdline[0])
+		kinfo(LOG_KERN, "multiboot: command line '%s'\n", bootparams.bp_cmdline);
+}
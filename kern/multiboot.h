@@ -0,0 +1,38 @@
+#ifndef JOS_KERN_MULTIBOOT_H
+#define JOS_KERN_MULTIBOOT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/multiboot.h>
+
+#define MEMMAP_MAX	32	// Memory map entries kept from the loader
+#define CMDLINE_MAX	128
+
+// A physical memory region, as reported by the loader.
+struct Memregion {
+	uint64_t mr_addr;
+	uint64_t mr_len;
+	uint32_t mr_type;	// MULTIBOOT_MEMORY_*
+};
+
+// What we learned from the Multiboot loader, copied out of the info
+// block before anything can overwrite it.
+struct Bootparams {
+	bool bp_multiboot;	// Were we booted by a Multiboot loader?
+	uint32_t bp_flags;	// MULTIBOOT_INFO_* flags from the loader
+	uint32_t bp_mem_lower;	// KB of memory from 0
+	uint32_t bp_mem_upper;	// KB of memory from 1MB
+	char bp_cmdline[CMDLINE_MAX];
+	char bp_loader[32];
+	int bp_nmemmap;
+	struct Memregion bp_memmap[MEMMAP_MAX];
+};
+
+extern struct Bootparams bootparams;
+
+void multiboot_init(uint32_t magic, physaddr_t info);
+void multiboot_print(void);
+const char *memmap_type(uint32_t type);
+
+#endif	// !JOS_KERN_MULTIBOOT_H
@@ -0,0 +1,656 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/kclock.h>
+#include <kern/multiboot.h>
+#include <kern/log.h>
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+static size_t npages_basemem;	// Amount of base memory (in pages)
+
+// These variables are set in mem_init()
+pde_t *kern_pgdir;		// Kernel's initial page directory
+struct PageInfo *pages;		// Physical page state array
+
+// The buddy allocator's free lists: free_area[o] holds the free blocks
+// of 2^o pages, linked through the PageInfo of each block's first page.
+static struct {
+	struct PageInfo *head;
+	size_t nblocks;
+} free_area[PAGE_NORDERS];
+
+// entry_pgdir maps physical [0, 256MB) at KERNBASE, and so does
+// kern_pgdir; we cannot manage memory beyond that.
+#define MAXPHYS		((physaddr_t) (0xFFFFFFFF - KERNBASE + 1))
+
+// The pool of pre-zeroed pages that page_zero_idle fills and
+// page_alloc(ALLOC_ZERO) takes from.  Pooled pages are linked through
+// pp_link; as far as the free lists are concerned they are allocated.
+#define ZPOOL_MAX	32
+
+static struct {
+	struct PageInfo *head;
+	uint32_t count;
+	bool nt;			// CPU has non-temporal stores (SSE2)
+
+	// Statistics
+	uint32_t hits, misses;
+	uint64_t miss_cycles;		// Spent zeroing pages on a miss
+	uint64_t idle_cycles;		// Spent zeroing pages for the pool
+	uint32_t idle_pages;
+} zpool;
+
+static void boot_map_region_large(pde_t *pgdir, uintptr_t va, size_t size,
+				  physaddr_t pa, int perm);
+static void check_page_alloc(void);
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+static void
+i386_detect_memory(void)
+{
+	size_t basemem, extmem, ext16mem, totalmem;
+	uint64_t end;
+	int i;
+
+	// Use CMOS calls to measure available base & extended memory.
+	// (CMOS calls return results in kilobytes.)
+	basemem = nvram_read(NVRAM_BASELO);
+	extmem = nvram_read(NVRAM_EXTLO);
+	ext16mem = nvram_read(NVRAM_EXT16LO) * 64;
+
+	// Calculate the number of physical pages available in both base
+	// and extended memory.
+	if (ext16mem)
+		totalmem = 16 * 1024 + ext16mem;
+	else if (extmem)
+		totalmem = 1 * 1024 + extmem;
+	else
+		totalmem = basemem;
+
+	// A Multiboot loader's memory map knows better, if we have one.
+	end = 0;
+	for (i = 0; i < bootparams.bp_nmemmap; i++)
+		if (bootparams.bp_memmap[i].mr_type == MULTIBOOT_MEMORY_AVAILABLE)
+			end = MAX(end, bootparams.bp_memmap[i].mr_addr
+				  + bootparams.bp_memmap[i].mr_len);
+	if (end)
+		totalmem = MIN(end, (uint64_t) MAXPHYS) / 1024;
+
+	npages = MIN(totalmem, MAXPHYS / 1024) / (PGSIZE / 1024);
+	npages_basemem = basemem / (PGSIZE / 1024);
+
+	kinfo(LOG_MEM, "Physical memory: %uK available, base = %uK, extended = %uK\n",
+		totalmem, basemem, totalmem - basemem);
+}
+
+
+// This simple physical memory allocator is used only while JOS is setting
+// up its virtual memory system.  page_alloc() is the real allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold 'n'
+// bytes.  Doesn't initialize the memory.  Returns a kernel virtual address.
+//
+// If n==0, returns the address of the next free page without allocating
+// anything.
+//
+// If we're out of memory, boot_alloc should panic.
+// This function may ONLY be used during initialization,
+// before the page_free_list list has been set up.
+static void *
+boot_alloc(uint32_t n)
+{
+	static char *nextfree;	// virtual address of next byte of free memory
+	char *result;
+
+	// Initialize nextfree if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment:
+	// the first virtual address that the linker did *not* assign
+	// to any kernel code or global variables.
+	if (!nextfree) {
+		extern char end[];
+		nextfree = ROUNDUP((char *) end, PGSIZE);
+	}
+
+	result = nextfree;
+	nextfree = ROUNDUP(nextfree + n, PGSIZE);
+	if (PADDR(nextfree) > npages * PGSIZE)
+		panic("boot_alloc: out of memory allocating %u bytes", n);
+	return result;
+}
+
+// Set up a two-level page table:
+//    kern_pgdir is its linear (virtual) address of the root
+//
+// This sets up the kernel's part of the address space, which every
+// future address space will share, and the physical page allocator.
+//
+void
+mem_init(void)
+{
+	uint32_t edx;
+
+	// Find out how much memory the machine has (npages & npages_basemem).
+	i386_detect_memory();
+
+	//////////////////////////////////////////////////////////////////////
+	// create initial page directory.
+	kern_pgdir = (pde_t *) boot_alloc(PGSIZE);
+	memset(kern_pgdir, 0, PGSIZE);
+
+	//////////////////////////////////////////////////////////////////////
+	// Recursively insert PD in itself as a page table, to form
+	// a virtual page table at virtual address UVPT.
+	// Permissions: kernel R, user R
+	kern_pgdir[PDX(UVPT)] = PADDR(kern_pgdir) | PTE_U | PTE_P;
+
+	//////////////////////////////////////////////////////////////////////
+	// Allocate an array of npages 'struct PageInfo's and store it in 'pages'.
+	// The kernel uses this array to keep track of physical pages: for
+	// each physical page, there is a corresponding struct PageInfo in this
+	// array.  'npages' is the number of physical pages in memory.
+	pages = boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
+
+	//////////////////////////////////////////////////////////////////////
+	// Now that we've allocated the initial kernel data structures, we set
+	// up the free lists.  Once we've done so, all further memory management
+	// will go through the page_* functions.
+	page_init();
+
+	// Is movnti (SSE2) available for filling the zeroed page pool?
+	cpuid(1, NULL, NULL, NULL, &edx);
+	zpool.nt = (edx & (1 << 26)) != 0;
+
+	check_page_alloc();
+
+	//////////////////////////////////////////////////////////////////////
+	// Map all of physical memory at KERNBASE.
+	// Ie.  the VA range [KERNBASE, 2^32) should map to
+	//      the PA range [0, 2^32 - KERNBASE)
+	// We might not have 2^32 - KERNBASE bytes of physical memory, but
+	// we just set up the mapping anyway.
+	// These are 4MB pages (entry.S turned on CR4_PSE) and global
+	// (entry.S turned on CR4_PGE), so they stay in the TLB across
+	// every address space switch.
+	// Permissions: kernel RW, user NONE
+	boot_map_region_large(kern_pgdir, KERNBASE, MAXPHYS, 0,
+			      PTE_W | PTE_G);
+
+	// Switch from the minimal entry page directory to the full kern_pgdir
+	// page table we just created.	Our instruction pointer should be
+	// somewhere between KERNBASE and KERNBASE+4MB right now, which is
+	// mapped the same way by both page tables.
+	lcr3(PADDR(kern_pgdir));
+}
+
+//
+// Map [va, va+size) of virtual address space to physical [pa, pa+size)
+// in the page directory rooted at pgdir with 4MB pages.  Size, va and
+// pa are multiples of PTSIZE.  Use permission bits perm|PTE_PS|PTE_P
+// for the entries.
+//
+// This function is only intended to set up the ``static'' mappings
+// above UTOP, so it doesn't need page tables or reference counts.
+//
+static void
+boot_map_region_large(pde_t *pgdir, uintptr_t va, size_t size,
+		      physaddr_t pa, int perm)
+{
+	size_t i;
+
+	assert(va % PTSIZE == 0 && size % PTSIZE == 0 && pa % PTSIZE == 0);
+	for (i = 0; i < size; i += PTSIZE)
+		pgdir[PDX(va + i)] = (pa + i) | perm | PTE_PS | PTE_P;
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct PageInfo' entry per physical page.
+// Pages are reference counted, and free pages are kept in blocks of
+// 2^order pages on the buddy allocator's free lists.
+// --------------------------------------------------------------
+
+static void
+free_area_push(struct PageInfo *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	pp->pp_prev = NULL;
+	pp->pp_link = free_area[order].head;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp;
+	free_area[order].head = pp;
+	free_area[order].nblocks++;
+}
+
+static void
+free_area_remove(struct PageInfo *pp, int order)
+{
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		free_area[order].head = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_link = pp->pp_prev = NULL;
+	pp->pp_flags &= ~PP_FREE;
+	free_area[order].nblocks--;
+}
+
+// Free the block of 2^order pages starting at page number 'pn',
+// merging it with its buddy for as long as the buddy is free too.
+static void
+buddy_free(size_t pn, int order)
+{
+	size_t buddy;
+
+	for (; order < PAGE_MAXORDER; order++) {
+		buddy = pn ^ (1 << order);
+		if (buddy + (1 << order) > npages
+		    || !(pages[buddy].pp_flags & PP_FREE)
+		    || pages[buddy].pp_order != order)
+			break;
+		free_area_remove(&pages[buddy], order);
+		pn &= ~(size_t) (1 << order);
+	}
+	free_area_push(&pages[pn], order);
+}
+
+// Give the pages in physical range [start, end) to the allocator,
+// leaving out the ones that are in use.
+static void
+page_init_range(uint64_t start, uint64_t end)
+{
+	size_t pn, pn_end, pn_free;
+	int order;
+
+	// Pages in use:
+	//  1) Physical page 0: the real-mode IDT and BIOS structures,
+	//     the boot info record (see inc/bootinfo.h), and the crash
+	//     record (see kern/crash.h).
+	//  2) The IO hole [IOPHYSMEM, EXTPHYSMEM).
+	//  3) Extended memory up to the end of what boot_alloc handed out:
+	//     the kernel, and the pages array.
+	if (start >= (uint64_t) npages * PGSIZE)
+		return;
+	end = MIN(end, (uint64_t) npages * PGSIZE);
+	pn = ROUNDUP(MAX((physaddr_t) start, (physaddr_t) PGSIZE), PGSIZE) / PGSIZE;
+	pn_end = end / PGSIZE;
+	pn_free = PGNUM(PADDR(boot_alloc(0)));
+
+	while (pn < pn_end) {
+		if (pn >= npages_basemem && pn < pn_free) {
+			pn = pn_free;
+			continue;
+		}
+		// The largest aligned block at pn that stays in range
+		for (order = 0; order < PAGE_MAXORDER; order++)
+			if ((pn & (1 << order))
+			    || pn + (2 << order) > pn_end
+			    || (pn < npages_basemem
+				&& pn + (2 << order) > npages_basemem))
+				break;
+		buddy_free(pn, order);
+		pn += 1 << order;
+	}
+}
+
+// Initialize page structures and the buddy allocator's free lists.
+// After this is done, NEVER use boot_alloc again.  ONLY use the page
+// allocator functions below to allocate and deallocate physical
+// memory via the free lists.
+void
+page_init(void)
+{
+	struct Memregion *mr;
+	int i;
+
+	// Every page starts out in use (pp_flags == 0); hand the usable
+	// ones to the allocator.  Prefer the Multiboot loader's memory map,
+	// which knows about holes the CMOS does not.
+	if (bootparams.bp_nmemmap > 0) {
+		for (i = 0; i < bootparams.bp_nmemmap; i++) {
+			mr = &bootparams.bp_memmap[i];
+			if (mr->mr_type == MULTIBOOT_MEMORY_AVAILABLE)
+				page_init_range(mr->mr_addr,
+						mr->mr_addr + mr->mr_len);
+		}
+	} else {
+		page_init_range(0, npages_basemem * PGSIZE);
+		page_init_range(EXTPHYSMEM, (uint64_t) npages * PGSIZE);
+	}
+}
+
+// Take a block of 2^order pages off the free lists, splitting the
+// smallest free block of at least that size in half until it is the
+// right size.  The unused halves go back on the free lists.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp;
+	int o;
+
+	for (o = order; o <= PAGE_MAXORDER; o++)
+		if (free_area[o].head)
+			break;
+	if (o > PAGE_MAXORDER)
+		return NULL;
+
+	pp = free_area[o].head;
+	free_area_remove(pp, o);
+	while (o > order) {
+		o--;
+		free_area_push(pp + (1 << o), o);
+	}
+	pp->pp_order = order;
+	return pp;
+}
+
+// Zero 'npg' pages at 'va'.  The usual way is rep stosl, which leaves
+// the pages in the cache for the caller that is about to use them.
+// Pages zeroed ahead of time for the pool use non-temporal stores, if
+// the CPU has them, so that they don't push anything useful out of
+// the cache.
+static void
+zero_pages(void *va, size_t npg, bool nontemporal)
+{
+	size_t n;
+
+	if (nontemporal && zpool.nt) {
+		n = npg * PGSIZE / 16;
+		asm volatile("1:\tmovnti %2, (%0)\n\t"
+			     "movnti %2, 4(%0)\n\t"
+			     "movnti %2, 8(%0)\n\t"
+			     "movnti %2, 12(%0)\n\t"
+			     "addl $16, %0\n\t"
+			     "decl %1\n\t"
+			     "jnz 1b\n\t"
+			     "sfence"
+			     : "+r" (va), "+r" (n)
+			     : "r" (0)
+			     : "cc", "memory");
+	} else {
+		n = npg * PGSIZE / 4;
+		asm volatile("cld; rep stosl"
+			     : "+D" (va), "+c" (n)
+			     : "a" (0)
+			     : "cc", "memory");
+	}
+}
+
+// Give the pre-zeroed pages back to the free lists.
+static void
+zpool_drain(void)
+{
+	struct PageInfo *pp;
+
+	while ((pp = zpool.head) != NULL) {
+		zpool.head = pp->pp_link;
+		pp->pp_link = NULL;
+		buddy_free(pp - pages, 0);
+	}
+	zpool.count = 0;
+}
+
+// Called when the kernel has nothing better to do (see getchar):
+// zero one free page and add it to the pool, if it isn't full.
+// One page at a time keeps the kernel responsive.
+// Returns false if there was nothing to do.
+bool
+page_zero_idle(void)
+{
+	struct PageInfo *pp;
+	uint64_t start;
+
+	if (!pages || zpool.count >= ZPOOL_MAX || (pp = buddy_alloc(0)) == NULL)
+		return 0;
+	start = read_tsc();
+	zero_pages(page2kva(pp), 1, 1);
+	zpool.idle_cycles += read_tsc() - start;
+	zpool.idle_pages++;
+	pp->pp_link = zpool.head;
+	zpool.head = pp;
+	zpool.count++;
+	return 1;
+}
+
+//
+// Allocates a block of 2^order physical pages.  If (alloc_flags &
+// ALLOC_ZERO), fills the entire block with '\0' bytes.  Does NOT
+// increment the reference count of the page - the caller must do
+// these if necessary (either explicitly or via page_insert).
+//
+// Single zeroed pages come from the pre-zeroed pool when it has any.
+//
+// Returns NULL if out of free memory.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+	uint64_t start;
+
+	if (order < 0 || order > PAGE_MAXORDER)
+		return NULL;
+
+	if (order == 0 && (alloc_flags & ALLOC_ZERO) && zpool.head) {
+		pp = zpool.head;
+		zpool.head = pp->pp_link;
+		zpool.count--;
+		zpool.hits++;
+		pp->pp_link = NULL;
+		return pp;
+	}
+
+	if ((pp = buddy_alloc(order)) == NULL && zpool.count > 0) {
+		zpool_drain();
+		pp = buddy_alloc(order);
+	}
+	if (pp == NULL)
+		return NULL;
+
+	if (alloc_flags & ALLOC_ZERO) {
+		start = read_tsc();
+		zero_pages(page2kva(pp), 1 << order, 0);
+		if (order == 0) {
+			zpool.misses++;
+			zpool.miss_cycles += read_tsc() - start;
+		}
+	}
+	return pp;
+}
+
+//
+// Allocates a physical page.  See page_alloc_order.
+//
+struct PageInfo *
+page_alloc(int alloc_flags)
+{
+	return page_alloc_order(0, alloc_flags);
+}
+
+//
+// Return a block of pages to the free lists.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free(struct PageInfo *pp)
+{
+	if (pp->pp_ref != 0)
+		panic("page_free: page %08x still referenced", page2pa(pp));
+	if (pp->pp_flags & PP_FREE)
+		panic("page_free: page %08x already free", page2pa(pp));
+	buddy_free(pp - pages, pp->pp_order);
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct PageInfo* pp)
+{
+	if (--pp->pp_ref == 0)
+		page_free(pp);
+}
+
+// Fill in free memory statistics.
+void
+page_meminfo(struct Meminfo *mi)
+{
+	int o;
+
+	mi->mi_npages = npages;
+	mi->mi_nfree = 0;
+	for (o = 0; o < PAGE_NORDERS; o++) {
+		mi->mi_nblocks[o] = free_area[o].nblocks;
+		mi->mi_nfree += free_area[o].nblocks << o;
+	}
+
+	mi->mi_zpool = zpool.count;
+	mi->mi_zpool_max = ZPOOL_MAX;
+	mi->mi_zpool_nt = zpool.nt;
+	mi->mi_zhits = zpool.hits;
+	mi->mi_zmisses = zpool.misses;
+	// Each hit saved what zeroing a page costs on a miss; until we
+	// have seen a miss, go by what it costs to fill the pool.
+	if (zpool.misses)
+		mi->mi_zsaved = zpool.miss_cycles / zpool.misses * zpool.hits;
+	else if (zpool.idle_pages)
+		mi->mi_zsaved = zpool.idle_cycles / zpool.idle_pages * zpool.hits;
+	else
+		mi->mi_zsaved = 0;
+}
+
+// The fragmentation index for 'order', in thousandths: the fraction of
+// free memory that is in blocks too small to satisfy a request for
+// 2^order pages.  0 means every free page could be used; 1000 means
+// no free block is big enough.
+int
+page_frag_index(const struct Meminfo *mi, int order)
+{
+	size_t usable = 0;
+	int o;
+
+	if (mi->mi_nfree == 0)
+		return 0;
+	for (o = order; o < PAGE_NORDERS; o++)
+		usable += mi->mi_nblocks[o] << o;
+	return (mi->mi_nfree - usable) * 1000 / mi->mi_nfree;
+}
+
+// Measure what an address space switch costs the kernel: switch from
+// kern_pgdir to a second page directory sharing its kernel mappings
+// (as a user environment's would), touch one word in each of the first
+// 'ntouch' 4MB pages of physical memory, switch back, and touch them
+// again.  With 'global' false, CR4_PGE is turned off for the run, so
+// every cr3 load flushes the kernel's TLB entries too.  Returns the
+// average cycles per switch, or 0 if out of memory.
+uint64_t
+pmap_switch_bench(bool global, int nswitch, int ntouch)
+{
+	struct PageInfo *pp;
+	pde_t *pgdir;
+	uint32_t cr4;
+	uint64_t start, end;
+	volatile uint32_t *va;
+	int i, j;
+
+	if ((pp = page_alloc(ALLOC_ZERO)) == NULL)
+		return 0;
+	pgdir = page2kva(pp);
+	memcpy(&pgdir[PDX(UTOP)], &kern_pgdir[PDX(UTOP)],
+	       (NPDENTRIES - PDX(UTOP)) * sizeof(pde_t));
+	ntouch = MIN(ntouch, (int) (npages * PGSIZE / PTSIZE));
+
+	// Changing CR4_PGE flushes the whole TLB, global entries included
+	cr4 = rcr4();
+	lcr4(global ? cr4 | CR4_PGE : cr4 & ~CR4_PGE);
+
+	start = read_tsc();
+	for (i = 0; i < nswitch; i++) {
+		lcr3(i & 1 ? PADDR(kern_pgdir) : page2pa(pp));
+		for (j = 0; j < ntouch; j++) {
+			va = (uint32_t *) (KERNBASE + j * PTSIZE);
+			(void) *va;
+		}
+	}
+	end = read_tsc();
+
+	lcr3(PADDR(kern_pgdir));
+	lcr4(cr4);
+	page_free(pp);
+	return nswitch ? (end - start) / nswitch : 0;
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+//
+// Check the buddy allocator: blocks are aligned and distinct, split
+// blocks are handed back out, and freeing everything coalesces the
+// free lists back to how they started.
+//
+static void
+check_page_alloc(void)
+{
+	struct PageInfo *pp, *pp0, *pp1, *pp2;
+	struct Meminfo before, after;
+	int o;
+
+	if (!pages)
+		panic("'pages' is a null pointer!");
+	page_meminfo(&before);
+	assert(before.mi_nfree > 0);
+
+	// every free block is aligned to its size and in usable memory
+	for (o = 0; o < PAGE_NORDERS; o++)
+		for (pp = free_area[o].head; pp; pp = pp->pp_link) {
+			assert((pp->pp_flags & PP_FREE) && pp->pp_order == o);
+			assert(((pp - pages) & ((1 << o) - 1)) == 0);
+			assert(page2pa(pp) != 0);
+			assert(page2pa(pp) < IOPHYSMEM
+			       || page2pa(pp) >= PADDR(boot_alloc(0)));
+		}
+
+	// should be able to allocate three pages and a larger block
+	assert((pp0 = page_alloc(0)));
+	assert((pp1 = page_alloc(0)));
+	assert((pp2 = page_alloc_order(3, ALLOC_ZERO)));
+	assert(pp0 != pp1 && pp1 != pp2 && pp0 != pp2);
+	assert(((pp2 - pages) & 7) == 0);
+	assert(((char *) page2kva(pp2))[8 * PGSIZE - 1] == 0);
+
+	// a freed page is the next one handed out
+	page_free(pp1);
+	assert(page_alloc(0) == pp1);
+
+	page_free(pp0);
+	page_free(pp1);
+	page_free(pp2);
+	page_meminfo(&after);
+	assert(after.mi_nfree == before.mi_nfree);
+	for (o = 0; o < PAGE_NORDERS; o++)
+		assert(after.mi_nblocks[o] == before.mi_nblocks[o]);
+
+	kinfo(LOG_MEM, "check_page_alloc() succeeded!\n");
+}
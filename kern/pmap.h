@@ -0,0 +1,106 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+extern char bootstacktop[], bootstack[];
+
+extern struct PageInfo *pages;
+extern size_t npages;
+
+extern pde_t *kern_pgdir;
+
+// The buddy allocator hands out blocks of 2^order pages,
+// for 0 <= order <= PAGE_MAXORDER.
+#define PAGE_MAXORDER	10
+#define PAGE_NORDERS	(PAGE_MAXORDER + 1)
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address.
+ */
+#define PADDR(kva) _paddr(__FILE__, __LINE__, kva)
+
+static inline physaddr_t
+_paddr(const char *file, int line, void *kva)
+{
+	if ((uint32_t)kva < KERNBASE)
+		_panic(file, line, "PADDR called with invalid kva %08lx", kva);
+	return (physaddr_t)kva - KERNBASE;
+}
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address. */
+#define KADDR(pa) _kaddr(__FILE__, __LINE__, pa)
+
+static inline void*
+_kaddr(const char *file, int line, physaddr_t pa)
+{
+	if (PGNUM(pa) >= npages)
+		_panic(file, line, "KADDR called with invalid pa %08lx", pa);
+	return (void *)(pa + KERNBASE);
+}
+
+
+enum {
+	// For page_alloc, zero the returned physical page.
+	ALLOC_ZERO = 1<<0,
+};
+
+void	mem_init(void);
+
+void	page_init(void);
+struct PageInfo *page_alloc(int alloc_flags);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free(struct PageInfo *pp);
+void	page_decref(struct PageInfo *pp);
+bool	page_zero_idle(void);
+
+// Free memory statistics, for the kernel monitor.
+struct Meminfo {
+	size_t mi_npages;		// Pages of physical memory
+	size_t mi_nfree;		// Free pages
+	size_t mi_nblocks[PAGE_NORDERS];	// Free blocks of each order
+
+	// The pre-zeroed page pool
+	uint32_t mi_zpool;		// Pages in the pool
+	uint32_t mi_zpool_max;
+	bool mi_zpool_nt;		// Filled with non-temporal stores
+	uint32_t mi_zhits;		// Zeroed page allocations served
+	uint32_t mi_zmisses;		//   ... and not served by the pool
+	uint64_t mi_zsaved;		// Estimated cycles saved by hits
+};
+
+void	page_meminfo(struct Meminfo *mi);
+int	page_frag_index(const struct Meminfo *mi, int order);
+
+uint64_t pmap_switch_bench(bool global, int nswitch, int ntouch);
+
+static inline physaddr_t
+page2pa(struct PageInfo *pp)
+{
+	return (pp - pages) << PGSHIFT;
+}
+
+static inline struct PageInfo*
+pa2page(physaddr_t pa)
+{
+	if (PGNUM(pa) >= npages)
+		panic("pa2page called with invalid pa");
+	return &pages[PGNUM(pa)];
+}
+
+static inline void*
+page2kva(struct PageInfo *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
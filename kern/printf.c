@@ -1,25 +1,54 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on printfmt() and the kernel console's cons_write().
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
+#include <inc/string.h>
+
+#include <kern/console.h>
+
+
+// Collect formatted output in a buffer on the stack and hand it to
+// the console a bufferful at a time, rather than a character at a time.
+struct printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	char buf[256];
+};
 
 
 static void
-putch(int ch, int *cnt)
+putbuf(const char *s, int n, struct printbuf *b)
 {
-	cputchar(ch);
-	*cnt++;
+	int k;
+
+	b->cnt += n;
+	while (n > 0) {
+		k = MIN(n, (int) sizeof(b->buf) - b->idx);
+		memcpy(b->buf + b->idx, s, k);
+		b->idx += k;
+		s += k;
+		n -= k;
+		if (b->idx == sizeof(b->buf)) {
+			cons_write(b->buf, b->idx);
+			b->idx = 0;
+		}
+	}
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
+	struct printbuf b;
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt_bulk((void*)putbuf, &b, fmt, ap);
+	cons_write(b.buf, b.idx);
+	cons_flush();
+
+	return b.cnt;
 }
 
 int
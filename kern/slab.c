@@ -0,0 +1,367 @@
+// Slab allocator for small kernel objects.
+//
+// Each cache hands out objects of one size.  It keeps its memory in
+// slabs, one page each: a struct Slab at the start of the page, then
+// as many objects as fit.  Free objects in a slab are linked through
+// their first word, so allocating and freeing are a few pointer moves.
+// A cache's slabs are on one of three lists: partial (some objects
+// free), full, and empty.  Allocation takes from a partial slab, then
+// an empty one, and only then asks the page allocator for a new page.
+//
+// kmalloc serves requests up to KMALLOC_MAX_SLAB bytes from a cache
+// per power-of-two size, and larger ones straight from page_alloc_order.
+// Slab objects are never page-aligned (the struct Slab is in the way),
+// so kfree can tell the two apart by the pointer alone.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/slab.h>
+#include <kern/pmap.h>
+#include <kern/log.h>
+
+struct Slab {
+	struct Slab *sl_next;		// Next and previous on the cache's
+	struct Slab *sl_prev;		//   partial, full, or empty list
+	struct Kmem_cache *sl_cache;
+	void *sl_free;			// First free object
+	uint32_t sl_inuse;		// Objects allocated from this slab
+};
+
+struct Kmem_cache {
+	char kc_name[16];
+	size_t kc_size;			// Object size, rounded up to kc_align
+	size_t kc_align;
+	size_t kc_offset;		// Offset of the first object in a slab
+	uint32_t kc_nobj;		// Objects per slab
+
+	struct Slab *kc_partial;
+	struct Slab *kc_full;
+	struct Slab *kc_empty;
+
+	// Statistics
+	uint32_t kc_inuse;		// Objects allocated
+	uint32_t kc_nslabs[3];		// Slabs on each list (SL_*)
+
+	struct Kmem_cache *kc_next;	// All caches, for kmem_print_stats
+};
+
+enum { SL_PARTIAL, SL_FULL, SL_EMPTY };
+
+// Keep at most this many empty slabs per cache; give the rest back.
+#define SLAB_EMPTY_MAX	1
+
+#define KMALLOC_MIN_SHIFT	3
+#define KMALLOC_NCACHES		8	// 8, 16, ..., KMALLOC_MAX_SLAB bytes
+
+// The cache that struct Kmem_caches come from, which has to be set up
+// by hand, and the kmalloc caches.
+static struct Kmem_cache cache_cache;
+static struct Kmem_cache *kmalloc_caches[KMALLOC_NCACHES];
+static struct Kmem_cache *all_caches;
+
+// Pages handed out by kmalloc for large requests
+static uint32_t kmalloc_nlarge, kmalloc_large_pages;
+
+static void check_kmalloc(void);
+
+static struct Slab **
+slab_list(struct Kmem_cache *kc, int which)
+{
+	switch (which) {
+	case SL_PARTIAL:
+		return &kc->kc_partial;
+	case SL_FULL:
+		return &kc->kc_full;
+	default:
+		return &kc->kc_empty;
+	}
+}
+
+static void
+slab_list_add(struct Kmem_cache *kc, int which, struct Slab *sl)
+{
+	struct Slab **head = slab_list(kc, which);
+
+	sl->sl_prev = NULL;
+	sl->sl_next = *head;
+	if (*head)
+		(*head)->sl_prev = sl;
+	*head = sl;
+	kc->kc_nslabs[which]++;
+}
+
+static void
+slab_list_del(struct Kmem_cache *kc, int which, struct Slab *sl)
+{
+	if (sl->sl_prev)
+		sl->sl_prev->sl_next = sl->sl_next;
+	else
+		*slab_list(kc, which) = sl->sl_next;
+	if (sl->sl_next)
+		sl->sl_next->sl_prev = sl->sl_prev;
+	kc->kc_nslabs[which]--;
+}
+
+static void
+cache_init(struct Kmem_cache *kc, const char *name, size_t size,
+	   size_t align)
+{
+	memset(kc, 0, sizeof(*kc));
+	strlcpy(kc->kc_name, name, sizeof(kc->kc_name));
+	kc->kc_align = align;
+	kc->kc_size = ROUNDUP(MAX(size, sizeof(void *)), align);
+	kc->kc_offset = ROUNDUP(sizeof(struct Slab), align);
+	kc->kc_nobj = (PGSIZE - kc->kc_offset) / kc->kc_size;
+	kc->kc_next = all_caches;
+	all_caches = kc;
+}
+
+// Create a cache of objects of 'size' bytes aligned to 'align' (a
+// power of two, or 0 for word alignment).  Objects must fit in a page
+// along with the slab header.  Returns NULL if they do not, or if
+// we are out of memory.
+struct Kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align)
+{
+	struct Kmem_cache *kc;
+
+	if (align == 0)
+		align = sizeof(void *);
+	if ((align & (align - 1)) != 0
+	    || ROUNDUP(sizeof(struct Slab), align) + ROUNDUP(size, align) > PGSIZE)
+		return NULL;
+	if ((kc = kmem_cache_alloc(&cache_cache)) == NULL)
+		return NULL;
+	cache_init(kc, name, size, align);
+	return kc;
+}
+
+// Destroy a cache created by kmem_cache_create.  All of its objects
+// must have been freed.
+void
+kmem_cache_destroy(struct Kmem_cache *kc)
+{
+	struct Kmem_cache **kcp;
+	struct Slab *sl;
+
+	if (kc->kc_inuse)
+		panic("kmem_cache_destroy: %s still has %u objects in use",
+		      kc->kc_name, kc->kc_inuse);
+	while ((sl = kc->kc_empty) != NULL) {
+		slab_list_del(kc, SL_EMPTY, sl);
+		page_decref(pa2page(PADDR(sl)));
+	}
+	for (kcp = &all_caches; *kcp != kc; kcp = &(*kcp)->kc_next)
+		/* do nothing */;
+	*kcp = kc->kc_next;
+	kmem_cache_free(&cache_cache, kc);
+}
+
+// Get a fresh slab for 'kc' from the page allocator and thread its
+// objects onto its free list.
+static struct Slab *
+slab_grow(struct Kmem_cache *kc)
+{
+	struct PageInfo *pp;
+	struct Slab *sl;
+	char *obj;
+	uint32_t i;
+
+	if ((pp = page_alloc(0)) == NULL)
+		return NULL;
+	pp->pp_ref++;
+	sl = page2kva(pp);
+	sl->sl_cache = kc;
+	sl->sl_inuse = 0;
+	sl->sl_free = NULL;
+	obj = (char *) sl + kc->kc_offset + (kc->kc_nobj - 1) * kc->kc_size;
+	for (i = 0; i < kc->kc_nobj; i++, obj -= kc->kc_size) {
+		*(void **) obj = sl->sl_free;
+		sl->sl_free = obj;
+	}
+	slab_list_add(kc, SL_EMPTY, sl);
+	return sl;
+}
+
+// Allocate an object from 'kc'.  Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct Kmem_cache *kc)
+{
+	struct Slab *sl;
+	void *obj;
+
+	if ((sl = kc->kc_partial) != NULL) {
+		// Fast path: no list changes unless the slab fills up
+		obj = sl->sl_free;
+		sl->sl_free = *(void **) obj;
+		if (++sl->sl_inuse == kc->kc_nobj) {
+			slab_list_del(kc, SL_PARTIAL, sl);
+			slab_list_add(kc, SL_FULL, sl);
+		}
+		kc->kc_inuse++;
+		return obj;
+	}
+
+	if ((sl = kc->kc_empty) == NULL && (sl = slab_grow(kc)) == NULL)
+		return NULL;
+	obj = sl->sl_free;
+	sl->sl_free = *(void **) obj;
+	sl->sl_inuse++;
+	slab_list_del(kc, SL_EMPTY, sl);
+	slab_list_add(kc, sl->sl_inuse == kc->kc_nobj ? SL_FULL : SL_PARTIAL, sl);
+	kc->kc_inuse++;
+	return obj;
+}
+
+// Return 'obj' to 'kc'.
+void
+kmem_cache_free(struct Kmem_cache *kc, void *obj)
+{
+	struct Slab *sl = ROUNDDOWN(obj, PGSIZE);
+
+	if (sl->sl_cache != kc)
+		panic("kmem_cache_free: %08x is not from cache %s",
+		      obj, kc->kc_name);
+
+	*(void **) obj = sl->sl_free;
+	sl->sl_free = obj;
+	kc->kc_inuse--;
+
+	if (sl->sl_inuse-- == kc->kc_nobj) {
+		slab_list_del(kc, SL_FULL, sl);
+		slab_list_add(kc, sl->sl_inuse ? SL_PARTIAL : SL_EMPTY, sl);
+	} else if (sl->sl_inuse == 0) {
+		slab_list_del(kc, SL_PARTIAL, sl);
+		slab_list_add(kc, SL_EMPTY, sl);
+	} else
+		return;
+
+	// Don't hang on to more empty slabs than we need
+	if (kc->kc_nslabs[SL_EMPTY] > SLAB_EMPTY_MAX) {
+		slab_list_del(kc, SL_EMPTY, sl);
+		page_decref(pa2page(PADDR(sl)));
+	}
+}
+
+// Allocate 'size' bytes.  Returns NULL if out of memory.
+void *
+kmalloc(size_t size)
+{
+	struct PageInfo *pp;
+	int i, order;
+
+	if (size <= KMALLOC_MAX_SLAB) {
+		for (i = 0; (size_t) 1 << (KMALLOC_MIN_SHIFT + i) < size; i++)
+			/* do nothing */;
+		return kmem_cache_alloc(kmalloc_caches[i]);
+	}
+
+	for (order = 0; order <= PAGE_MAXORDER && (size_t) PGSIZE << order < size;
+	     order++)
+		/* do nothing */;
+	if ((pp = page_alloc_order(order, 0)) == NULL)
+		return NULL;
+	pp->pp_ref++;
+	kmalloc_nlarge++;
+	kmalloc_large_pages += 1 << order;
+	return page2kva(pp);
+}
+
+// Free memory returned by kmalloc.  kfree(NULL) does nothing.
+void
+kfree(void *p)
+{
+	struct PageInfo *pp;
+
+	if (p == NULL)
+		return;
+	if (PGOFF(p) != 0) {
+		kmem_cache_free(((struct Slab *) ROUNDDOWN(p, PGSIZE))->sl_cache, p);
+		return;
+	}
+	pp = pa2page(PADDR(p));
+	kmalloc_nlarge--;
+	kmalloc_large_pages -= 1 << pp->pp_order;
+	page_decref(pp);
+}
+
+// Set up the kmalloc caches.  Must be called after mem_init.
+void
+kmem_init(void)
+{
+	char name[16];
+	int i;
+
+	cache_init(&cache_cache, "kmem_cache", sizeof(struct Kmem_cache),
+		   sizeof(void *));
+	for (i = 0; i < KMALLOC_NCACHES; i++) {
+		snprintf(name, sizeof(name), "kmalloc-%d",
+			 1 << (KMALLOC_MIN_SHIFT + i));
+		kmalloc_caches[i] = kmem_cache_create(name,
+			1 << (KMALLOC_MIN_SHIFT + i), 0);
+		if (!kmalloc_caches[i])
+			panic("kmem_init: out of memory");
+	}
+	check_kmalloc();
+}
+
+void
+kmem_print_stats(void)
+{
+	struct Kmem_cache *kc;
+	uint32_t nslabs, wasted;
+
+	cprintf("  %-14s %5s %7s %7s %13s %8s\n", "cache", "size",
+		"in use", "total", "slabs p/f/e", "wasted");
+	for (kc = all_caches; kc; kc = kc->kc_next) {
+		nslabs = kc->kc_nslabs[SL_PARTIAL] + kc->kc_nslabs[SL_FULL]
+			+ kc->kc_nslabs[SL_EMPTY];
+		// Everything in the slabs that isn't a live object
+		wasted = nslabs * PGSIZE - kc->kc_inuse * kc->kc_size;
+		cprintf("  %-14s %5u %7u %7u %5u/%3u/%3u %8u\n", kc->kc_name,
+			kc->kc_size, kc->kc_inuse, nslabs * kc->kc_nobj,
+			kc->kc_nslabs[SL_PARTIAL], kc->kc_nslabs[SL_FULL],
+			kc->kc_nslabs[SL_EMPTY], wasted);
+	}
+	cprintf("  large kmallocs: %u using %u pages\n",
+		kmalloc_nlarge, kmalloc_large_pages);
+}
+
+
+// Check that objects are distinct and aligned, that slabs move between
+// lists as they fill and drain, and that large requests work.
+static void
+check_kmalloc(void)
+{
+	struct Kmem_cache *kc;
+	void *obj[64], *big;
+	int i;
+
+	assert((kc = kmem_cache_create("check", 100, 32)));
+	assert(kc->kc_nobj < ARRAY_SIZE(obj));
+	for (i = 0; i < kc->kc_nobj + 1; i++) {
+		assert((obj[i] = kmem_cache_alloc(kc)));
+		assert(((uintptr_t) obj[i] & 31) == 0);
+		assert(i == 0 || obj[i] != obj[i - 1]);
+		memset(obj[i], i, 100);
+	}
+	assert(kc->kc_nslabs[SL_FULL] == 1 && kc->kc_nslabs[SL_PARTIAL] == 1);
+	for (i = 0; i < kc->kc_nobj + 1; i++) {
+		assert(*(uint8_t *) (obj[i] + 99) == (uint8_t) i);
+		kmem_cache_free(kc, obj[i]);
+	}
+	assert(kc->kc_inuse == 0 && kc->kc_nslabs[SL_EMPTY] == SLAB_EMPTY_MAX);
+	kmem_cache_destroy(kc);
+
+	assert((obj[0] = kmalloc(1)) && (obj[1] = kmalloc(KMALLOC_MAX_SLAB)));
+	assert((big = kmalloc(3 * PGSIZE)) && PGOFF(big) == 0);
+	assert(kmalloc_large_pages == 4);
+	kfree(obj[0]);
+	kfree(obj[1]);
+	kfree(big);
+	assert(kmalloc_nlarge == 0);
+
+	kinfo(LOG_MEM, "check_kmalloc() succeeded!\n");
+}
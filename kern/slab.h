@@ -0,0 +1,28 @@
+#ifndef JOS_KERN_SLAB_H
+#define JOS_KERN_SLAB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Largest request kmalloc serves from a slab cache; bigger ones get
+// a block of whole pages from the page allocator.
+#define KMALLOC_MAX_SLAB	1024
+
+struct Kmem_cache;
+
+void	kmem_init(void);
+
+struct Kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align);
+void	kmem_cache_destroy(struct Kmem_cache *kc);
+void	*kmem_cache_alloc(struct Kmem_cache *kc);
+void	kmem_cache_free(struct Kmem_cache *kc, void *obj);
+
+void	*kmalloc(size_t size);
+void	kfree(void *p);
+
+void	kmem_print_stats(void);
+
+#endif	// !JOS_KERN_SLAB_H
@@ -0,0 +1,128 @@
+// Kernel trace ring (see kern/trace.h).
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+
+#include <kern/trace.h>
+#include <kern/tsc.h>
+
+static const char * const trace_names[TR_NEVENTS] = {
+	[TR_CONS_INTR]	= "cons_intr",
+	[TR_RUNCMD]	= "runcmd",
+	[TR_DEBUGINFO]	= "debuginfo",
+	[TR_PANIC]	= "panic",
+};
+
+#ifdef JOS_TRACE
+struct Trace_ring trace_ring;
+#endif
+
+// Return the ID of the event called 'name', or -1.
+int
+trace_event_id(const char *name)
+{
+	int i;
+
+	for (i = 1; i < TR_NEVENTS; i++)
+		if (strcmp(trace_names[i], name) == 0)
+			return i;
+	return -1;
+}
+
+// Print one trace record.  If 'old', the record comes from an earlier
+// boot (see kern/crash.h), whose string pointers may point anywhere in
+// this kernel, so print them in hex instead.
+void
+trace_print_rec(const struct Trace_rec *r, bool old)
+{
+	char cmd[9];
+
+	cprintf("[%10llu] %-10s ", tsc_to_us(r->tr_tsc),
+		r->tr_event < TR_NEVENTS && trace_names[r->tr_event]
+		? trace_names[r->tr_event] : "?");
+	switch (r->tr_event) {
+	case TR_CONS_INTR:
+		if (old) {
+			cprintf("0x%02x from %08x, %u queued\n",
+				r->tr_a, r->tr_b, r->tr_c);
+			break;
+		}
+		cprintf("0x%02x from %s, %u queued\n",
+			r->tr_a, (const char *) r->tr_b, r->tr_c);
+		break;
+	case TR_RUNCMD:
+		memcpy(cmd, &r->tr_b, 4);
+		memcpy(cmd + 4, &r->tr_c, 4);
+		cmd[8] = 0;
+		cprintf("%s, %d args\n", cmd, r->tr_a);
+		break;
+	case TR_DEBUGINFO:
+		if (r->tr_c)
+			cprintf("%08x not found\n", r->tr_a);
+		else
+			cprintf("%08x line %d\n", r->tr_a, r->tr_b);
+		break;
+	case TR_PANIC:
+		if (old) {
+			cprintf("%08x:%d: %08x\n", r->tr_a, r->tr_b, r->tr_c);
+			break;
+		}
+		cprintf("%s:%d: %s\n", (const char *) r->tr_a, r->tr_b,
+			(const char *) r->tr_c);
+		break;
+	default:
+		cprintf("%08x %08x %08x\n", r->tr_a, r->tr_b, r->tr_c);
+		break;
+	}
+}
+
+// Copy the last n trace records (fewer, if there aren't n) to recs,
+// oldest first.  Returns the number copied.
+int
+trace_copy(struct Trace_rec *recs, int n)
+{
+#ifdef JOS_TRACE
+	uint32_t pos, end, eflags;
+	int i;
+
+	eflags = read_eflags();
+	cli();
+	end = trace_ring.tr_pos;
+	n = MIN(n, (int) MIN(end, TRACE_SIZE));
+	for (i = 0, pos = end - n; i < n; i++, pos++)
+		recs[i] = trace_ring.tr_recs[pos & (TRACE_SIZE - 1)];
+	write_eflags(eflags);
+	return n;
+#else
+	return 0;
+#endif
+}
+
+// Print the last n trace records (all of them, if n <= 0), oldest
+// first, skipping events not in 'mask' (bit i for event ID i).
+void
+trace_print(int n, uint32_t mask)
+{
+#ifdef JOS_TRACE
+	struct Trace_rec rec;
+	uint32_t pos, end, eflags;
+
+	end = trace_ring.tr_pos;
+	if (n <= 0 || n > TRACE_SIZE)
+		n = TRACE_SIZE;
+	for (pos = end > (uint32_t) n ? end - n : 0; pos != end; pos++) {
+		// Copy the record with interrupts off, so no trace point
+		// in an interrupt handler changes it under us.
+		eflags = read_eflags();
+		cli();
+		rec = trace_ring.tr_recs[pos & (TRACE_SIZE - 1)];
+		write_eflags(eflags);
+		if (mask & (1 << rec.tr_event))
+			trace_print_rec(&rec, 0);
+	}
+#else
+	cprintf("Tracing is compiled out (TRACE=0)\n");
+#endif
+}
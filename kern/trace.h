@@ -0,0 +1,87 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// Kernel trace ring: fixed-size binary records of what the kernel did
+// lately, each a TSC stamp, an event ID, and three payload words.
+// A trace point is a handful of instructions; building with TRACE=0
+// (see GNUmakefile) compiles every trace point, arguments and all, out
+// of the kernel.
+
+// Event IDs, and what their payload words hold.
+// Keep trace_names in kern/trace.c in step.
+enum {
+	TR_CONS_INTR = 1,	// a: input char, b: source name, c: queued
+	TR_RUNCMD,		// a: argc, b-c: first 8 bytes of command
+	TR_DEBUGINFO,		// a: eip, b: line, c: 0, or -1 if not found
+	TR_PANIC,		// a: file name, b: line, c: format
+	TR_NEVENTS
+};
+
+#define TRACE_SIZE	512	// Records in the ring; must be a power of 2
+
+struct Trace_rec {
+	uint64_t tr_tsc;
+	uint32_t tr_event;
+	uint32_t tr_a, tr_b, tr_c;
+};
+
+struct Trace_ring {
+	uint32_t tr_pos;	// Records ever written
+	struct Trace_rec tr_recs[TRACE_SIZE];
+};
+
+#ifdef JOS_TRACE
+
+extern struct Trace_ring trace_ring;
+
+// Claiming a slot is atomic, so an interrupt handler can trace in the
+// middle of another trace point.
+static inline void
+trace_event(uint32_t event, uint32_t a, uint32_t b, uint32_t c)
+{
+	struct Trace_rec *r;
+
+	r = &trace_ring.tr_recs[__atomic_fetch_add(&trace_ring.tr_pos, 1,
+						   __ATOMIC_RELAXED)
+				& (TRACE_SIZE - 1)];
+	r->tr_tsc = read_tsc();
+	r->tr_event = event;
+	r->tr_a = a;
+	r->tr_b = b;
+	r->tr_c = c;
+}
+
+// Word i of the first 8 bytes of string s, for payloads
+static inline uint32_t
+trace_strword(const char *s, int i)
+{
+	uint32_t w = 0;
+	int k;
+
+	for (k = 0; k < 4 * i + 4 && s[k]; k++)
+		if (k >= 4 * i)
+			w |= (uint32_t) (uint8_t) s[k] << (8 * (k - 4 * i));
+	return w;
+}
+
+#define TRACE(event, a, b, c) \
+	trace_event((event), (uint32_t) (a), (uint32_t) (b), (uint32_t) (c))
+
+#else
+
+#define TRACE(event, a, b, c)	do { } while (0)
+
+#endif	// !JOS_TRACE
+
+int trace_event_id(const char *name);
+int trace_copy(struct Trace_rec *recs, int n);
+void trace_print_rec(const struct Trace_rec *r, bool old);
+void trace_print(int n, uint32_t mask);
+
+#endif	// !JOS_KERN_TRACE_H
@@ -0,0 +1,63 @@
+// Time stamp counter calibration.
+
+#include <inc/x86.h>
+
+#include <kern/tsc.h>
+
+// The 8254 PIT runs at this many Hz on every PC
+#define PIT_HZ		1193182
+
+#define PIT_CH2		0x42	// Channel 2 data port
+#define PIT_MODE	0x43	// Mode/command register
+#define   PIT_SEL2	0x80	//   Select channel 2
+#define   PIT_LOHI	0x30	//   Access low byte, then high byte
+#define   PIT_ONESHOT	0x00	//   Mode 0: interrupt on terminal count
+#define PORT_B		0x61	// System control port B
+#define   PORT_B_GATE2	0x01	//   Gate input of PIT channel 2
+#define   PORT_B_SPKR	0x02	//   Speaker data enable
+#define   PORT_B_OUT2	0x20	//   Output of PIT channel 2
+
+#define CALIBRATE_MS	10
+
+static uint64_t tsc_hz;
+
+// Count TSC cycles while PIT channel 2 counts down CALIBRATE_MS
+// milliseconds, with the speaker disconnected.
+static uint64_t
+tsc_calibrate(void)
+{
+	uint32_t latch = PIT_HZ * CALIBRATE_MS / 1000;
+	uint64_t t0, t1;
+
+	outb(PORT_B, (inb(PORT_B) & ~PORT_B_SPKR) | PORT_B_GATE2);
+	outb(PIT_MODE, PIT_SEL2 | PIT_LOHI | PIT_ONESHOT);
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	t0 = read_tsc();
+	while (!(inb(PORT_B) & PORT_B_OUT2))
+		/* do nothing */;
+	t1 = read_tsc();
+
+	return (t1 - t0) * PIT_HZ / latch;
+}
+
+// Return the TSC frequency in Hz, calibrating it the first time.
+uint64_t
+tsc_freq(void)
+{
+	if (!tsc_hz)
+		tsc_hz = tsc_calibrate();
+	return tsc_hz;
+}
+
+// Convert a number of TSC cycles to microseconds.
+uint64_t
+tsc_to_us(uint64_t cycles)
+{
+	uint64_t hz = tsc_freq();
+
+	if (!hz)
+		return 0;
+	return cycles * 1000000 / hz;
+}
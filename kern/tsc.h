@@ -0,0 +1,12 @@
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+uint64_t tsc_freq(void);
+uint64_t tsc_to_us(uint64_t cycles);
+
+#endif	// !JOS_KERN_TSC_H
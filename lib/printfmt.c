@@ -28,25 +28,161 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+// Where formatted output goes: a character at a time through putch,
+// or, if putbuf isn't NULL, a run of characters at a time.
+struct printer {
+	void (*putch)(int, void*);
+	void (*putbuf)(const char*, int, void*);
+	void *putdat;
+};
+
+static void
+putrun(const struct printer *pr, const char *s, int n)
+{
+	if (pr->putbuf)
+		pr->putbuf(s, n, pr->putdat);
+	else
+		while (n-- > 0)
+			pr->putch(*s++, pr->putdat);
+}
+
+static void
+putone(const struct printer *pr, int ch)
+{
+	char c = ch;
+
+	if (pr->putbuf)
+		pr->putbuf(&c, 1, pr->putdat);
+	else
+		pr->putch(ch, pr->putdat);
+}
+
+// Output n copies of padc.
+static void
+putpad(const struct printer *pr, int padc, int n)
+{
+	char buf[16];
+	int k;
+
+	if (n <= 0)
+		return;
+	memset(buf, padc, MIN(n, (int) sizeof(buf)));
+	for (; n > 0; n -= k) {
+		k = MIN(n, (int) sizeof(buf));
+		putrun(pr, buf, k);
+	}
+}
+
+static const char digits[] = "0123456789abcdef";
+
+// The two-digit decimal strings "00" to "99", back to back
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Write 'n' in decimal, at least 'ndigits' digits, ending just
+// before 'end'.  Returns a pointer to the first digit.
+static char *
+fmtdec32(char *end, uint32_t n, int ndigits)
+{
+	char *p = end;
+	uint32_t r;
+
+	// Two digits per division
+	while (n >= 100) {
+		r = n % 100;
+		n /= 100;
+		p -= 2;
+		p[0] = digit_pairs[2 * r];
+		p[1] = digit_pairs[2 * r + 1];
+	}
+	if (n >= 10) {
+		p -= 2;
+		p[0] = digit_pairs[2 * n];
+		p[1] = digit_pairs[2 * n + 1];
+	} else
+		*--p = '0' + n;
+	while (p > end - ndigits)
+		*--p = '0';
+	return p;
+}
+
+// Write 'num' in base 8, 10, or 16 ending just before 'end'.
+// Returns a pointer to the first digit.
+static char *
+fmtnum(char *end, unsigned long long num, unsigned base)
+{
+	char *p = end;
+	int shift;
+
+	if (base != 10) {
+		shift = (base == 16 ? 4 : 3);
+		do {
+			*--p = digits[num & (base - 1)];
+			num >>= shift;
+		} while (num);
+		return p;
+	}
+
+	// 64-bit division is a library call on x86, so use it only to
+	// cut the number down to 32 bits, nine digits at a time.
+	while (num > 0xFFFFFFFF) {
+		p = fmtdec32(p, num % 1000000000, 9);
+		num /= 1000000000;
+	}
+	return fmtdec32(p, num, 0);
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+ * Print a number (base 8, 10, or 16), with a minus sign in front if
+ * 'neg', padded to 'width' with padc on the left, or with spaces on
+ * the right if padc is '-'.  The number is formatted into a buffer and
+ * output in one run.
  */
 static void
-printnum(void (*putch)(int, void*), void *putdat,
-	 unsigned long long num, unsigned base, int width, int padc)
+printnum(const struct printer *pr, unsigned long long num, unsigned base,
+	 int width, int padc, bool neg)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
-	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+	char buf[32];	// 22 octal digits for 2^64-1, a sign, some padding
+	char *end = buf + sizeof(buf), *p;
+	int len;
+
+	p = fmtnum(end, num, base);
+
+	// Pad in the buffer, if there is room, so the common cases (like
+	// %08x) come out in one piece.  Zeros go after the sign; spaces
+	// go before it.
+	if (neg && padc != '0')
+		*--p = '-';
+	if (padc != '-')
+		while (end - p + (neg && padc == '0') < width && p > buf + 1)
+			*--p = padc;
+	if (neg && padc == '0')
+		*--p = '-';
+	len = end - p;
+
+	if (padc == '-') {
+		putrun(pr, p, len);
+		putpad(pr, ' ', width - len);
+		return;
 	}
-
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+	// Padding that didn't fit in the buffer
+	if (width > len) {
+		if (neg && padc == '0') {
+			putone(pr, '-');
+			p++, len--, width--;
+		}
+		putpad(pr, padc, width - len);
+	}
+	putrun(pr, p, len);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -76,171 +212,380 @@ getint(va_list *ap, int lflag)
 }
 
 
-// Main function to format and print a string.
-void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
+// A parsed piece of a format string: either a run of literal text
+// or one %-escape, with its flags, width, and precision.
+struct fmtop {
+	char fo_conv;		// Conversion character, or 0 for text
+	char fo_padc;
+	uint8_t fo_lflag;
+	uint8_t fo_altflag;
+	int fo_width;
+	int fo_precision;
+	uint16_t fo_off;	// Text: offset in the format string
+	uint16_t fo_len;	// Text: length
+};
 
-void
-vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+// Parse the %-escape just past the '%' at 'fmt' into *op, and return
+// a pointer past the escape.  A '*' takes the next int from *ap; if
+// ap is NULL, there are no arguments yet, so return NULL instead.
+static const char *
+fmtparse(const char *fmt, struct fmtop *op, va_list *ap)
+{
+	const char *start = fmt;
+	int ch, width, precision;
+
+	op->fo_padc = ' ';
+	op->fo_lflag = 0;
+	op->fo_altflag = 0;
+	width = -1;
+	precision = -1;
+reswitch:
+	switch (ch = *(unsigned char *) fmt++) {
+
+	// flag to pad on the right
+	case '-':
+		op->fo_padc = '-';
+		goto reswitch;
+
+	// flag to pad with 0's instead of spaces
+	case '0':
+		op->fo_padc = '0';
+		goto reswitch;
+
+	// width field
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		for (precision = 0; ; ++fmt) {
+			precision = precision * 10 + ch - '0';
+			ch = *fmt;
+			if (ch < '0' || ch > '9')
+				break;
+		}
+		goto process_precision;
+
+	case '*':
+		if (!ap)
+			return NULL;
+		precision = va_arg(*ap, int);
+		goto process_precision;
+
+	case '.':
+		if (width < 0)
+			width = 0;
+		goto reswitch;
+
+	case '#':
+		op->fo_altflag = 1;
+		goto reswitch;
+
+	process_precision:
+		if (width < 0)
+			width = precision, precision = -1;
+		goto reswitch;
+
+	// long flag (doubled for long long)
+	case 'l':
+		op->fo_lflag++;
+		goto reswitch;
+
+	case 'c':
+	case 'e':
+	case 's':
+	case 'd':
+	case 'u':
+	case 'o':
+	case 'p':
+	case 'x':
+	case '%':
+		op->fo_conv = ch;
+		break;
+
+	// unrecognized escape sequence - just print it literally:
+	// a '%', then the rest as text
+	default:
+		op->fo_conv = '%';
+		fmt = start;
+		break;
+	}
+
+	op->fo_width = width;
+	op->fo_precision = precision;
+	return fmt;
+}
+
+// Output one parsed %-escape, taking its argument from *ap.
+static void
+fmtconv(const struct printer *pr, const struct fmtop *op, va_list *ap)
 {
 	register const char *p;
 	register int ch, err;
 	unsigned long long num;
-	int base, lflag, width, precision, altflag;
-	char padc;
+	int base, width, precision;
+	bool neg = 0;
+
+	width = op->fo_width;
+	precision = op->fo_precision;
+	switch (op->fo_conv) {
+
+	// character
+	case 'c':
+		putone(pr, va_arg(*ap, int));
+		break;
+
+	// error message
+	case 'e':
+		err = va_arg(*ap, int);
+		if (err < 0)
+			err = -err;
+		if (err >= MAXERROR || (p = error_string[err]) == NULL) {
+			putrun(pr, "error ", 6);
+			printnum(pr, err, 10, -1, ' ', 0);
+		} else
+			putrun(pr, p, strlen(p));
+		break;
+
+	// string
+	case 's':
+		if ((p = va_arg(*ap, char *)) == NULL)
+			p = "(null)";
+		if (width > 0 && op->fo_padc != '-') {
+			width -= strnlen(p, precision);
+			putpad(pr, op->fo_padc, width);
+			width = 0;
+		}
+		if (!op->fo_altflag) {
+			ch = strnlen(p, precision);
+			putrun(pr, p, ch);
+			width -= ch;
+		} else
+			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
+				if (ch < ' ' || ch > '~')
+					putone(pr, '?');
+				else
+					putone(pr, ch);
+		putpad(pr, ' ', width);
+		break;
+
+	// (signed) decimal
+	case 'd':
+		num = getint(ap, op->fo_lflag);
+		if ((long long) num < 0) {
+			neg = 1;
+			num = -(long long) num;
+		}
+		base = 10;
+		goto number;
+
+	// unsigned decimal
+	case 'u':
+		num = getuint(ap, op->fo_lflag);
+		base = 10;
+		goto number;
+
+	// (unsigned) octal
+	case 'o':
+		num = getuint(ap, op->fo_lflag);
+		base = 8;
+		goto number;
+
+	// pointer
+	case 'p':
+		putrun(pr, "0x", 2);
+		num = (unsigned long long)
+			(uintptr_t) va_arg(*ap, void *);
+		base = 16;
+		goto number;
+
+	// (unsigned) hexadecimal
+	case 'x':
+		num = getuint(ap, op->fo_lflag);
+		base = 16;
+	number:
+		printnum(pr, num, base, width, op->fo_padc, neg);
+		break;
+
+	// escaped '%' character, or the '%' of an unrecognized escape
+	case '%':
+		putone(pr, '%');
+		break;
+	}
+}
+
+// Format and print, parsing the format string as we go.
+static void
+doprintfmt(const struct printer *pr, const char *fmt, va_list ap)
+{
+	struct fmtop op;
+	const char *p;
 
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
-		}
+		// Output the text up to the next %-escape in one run
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt > p)
+			putrun(pr, p, fmt - p);
+		if (*fmt++ == '\0')
+			return;
 
 		// Process a %-escape sequence
-		padc = ' ';
-		width = -1;
-		precision = -1;
-		lflag = 0;
-		altflag = 0;
-	reswitch:
-		switch (ch = *(unsigned char *) fmt++) {
-
-		// flag to pad on the right
-		case '-':
-			padc = '-';
-			goto reswitch;
-
-		// flag to pad with 0's instead of spaces
-		case '0':
-			padc = '0';
-			goto reswitch;
-
-		// width field
-		case '1':
-		case '2':
-		case '3':
-		case '4':
-		case '5':
-		case '6':
-		case '7':
-		case '8':
-		case '9':
-			for (precision = 0; ; ++fmt) {
-				precision = precision * 10 + ch - '0';
-				ch = *fmt;
-				if (ch < '0' || ch > '9')
-					break;
-			}
-			goto process_precision;
-
-		case '*':
-			precision = va_arg(ap, int);
-			goto process_precision;
-
-		case '.':
-			if (width < 0)
-				width = 0;
-			goto reswitch;
-
-		case '#':
-			altflag = 1;
-			goto reswitch;
-
-		process_precision:
-			if (width < 0)
-				width = precision, precision = -1;
-			goto reswitch;
-
-		// long flag (doubled for long long)
-		case 'l':
-			lflag++;
-			goto reswitch;
-
-		// character
-		case 'c':
-			putch(va_arg(ap, int), putdat);
-			break;
-
-		// error message
-		case 'e':
-			err = va_arg(ap, int);
-			if (err < 0)
-				err = -err;
-			if (err >= MAXERROR || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
-			break;
-
-		// string
-		case 's':
-			if ((p = va_arg(ap, char *)) == NULL)
-				p = "(null)";
-			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
-					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
-			for (; width > 0; width--)
-				putch(' ', putdat);
-			break;
-
-		// (signed) decimal
-		case 'd':
-			num = getint(&ap, lflag);
-			if ((long long) num < 0) {
-				putch('-', putdat);
-				num = -(long long) num;
-			}
-			base = 10;
-			goto number;
-
-		// unsigned decimal
-		case 'u':
-			num = getuint(&ap, lflag);
-			base = 10;
-			goto number;
-
-		// (unsigned) octal
-		case 'o':
-			// Replace this with your code.
-			putch('X', putdat);
-			putch('X', putdat);
-			putch('X', putdat);
-			break;
-
-		// pointer
-		case 'p':
-			putch('0', putdat);
-			putch('x', putdat);
-			num = (unsigned long long)
-				(uintptr_t) va_arg(ap, void *);
-			base = 16;
-			goto number;
-
-		// (unsigned) hexadecimal
-		case 'x':
-			num = getuint(&ap, lflag);
-			base = 16;
-		number:
-			printnum(putch, putdat, num, base, width, padc);
-			break;
-
-		// escaped '%' character
-		case '%':
-			putch(ch, putdat);
-			break;
-
-		// unrecognized escape sequence - just print it literally
-		default:
-			putch('%', putdat);
-			for (fmt--; fmt[-1] != '%'; fmt--)
-				/* do nothing */;
-			break;
+		fmt = fmtparse(fmt, &op, &ap);
+		fmtconv(pr, &op, &ap);
+	}
+}
+
+/*
+ * Format strings compiled to fmtop lists, for formats that will not
+ * change under us (the caller says which: see printfmt_cache_init),
+ * so the lists can be cached by the format string's address.  The
+ * cache is direct-mapped.
+ *
+ * A call made while the cache is in use -- e.g., by an interrupt
+ * handler that interrupted a cprintf -- goes around it, so that an
+ * entry never changes while it is being used.
+ */
+
+#define FMTCACHE_SIZE	32	// Must be a power of 2
+#define FMTCACHE_MAXOPS	16
+
+struct fmtcache_entry {
+	const char *fc_fmt;
+	int fc_nops;		// -1 if fc_fmt could not be compiled
+	struct fmtop fc_ops[FMTCACHE_MAXOPS];
+};
+
+static struct {
+	const char *lo, *hi;	// Formats in [lo, hi) are constant
+	bool enabled;
+	bool busy;
+	unsigned hits, misses, bypasses;
+	struct fmtcache_entry entries[FMTCACHE_SIZE];
+} fmtcache;
+
+// Compile 'fmt' into at most 'maxops' ops.  Returns the number of ops,
+// or -1 if the format has too many pieces or takes '*' arguments.
+static int
+fmtcompile(const char *fmt, struct fmtop *ops, int maxops)
+{
+	const char *start = fmt, *p;
+	int n = 0;
+
+	while (1) {
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt > p) {
+			if (n == maxops || fmt - start > 0xFFFF)
+				return -1;
+			ops[n].fo_conv = 0;
+			ops[n].fo_off = p - start;
+			ops[n].fo_len = fmt - p;
+			n++;
 		}
+		if (*fmt++ == '\0')
+			return n;
+
+		if (n == maxops || (fmt = fmtparse(fmt, &ops[n], NULL)) == NULL)
+			return -1;
+		n++;
+	}
+}
+
+static void
+fmtrun(const struct printer *pr, const char *fmt,
+       const struct fmtop *ops, int nops, va_list ap)
+{
+	for (; nops > 0; ops++, nops--)
+		if (ops->fo_conv == 0)
+			putrun(pr, fmt + ops->fo_off, ops->fo_len);
+		else
+			fmtconv(pr, ops, &ap);
+}
+
+static void
+fmtprint(const struct printer *pr, const char *fmt, va_list ap)
+{
+	struct fmtcache_entry *fc;
+
+	if (!fmtcache.enabled || fmtcache.busy
+	    || fmt < fmtcache.lo || fmt >= fmtcache.hi) {
+		fmtcache.bypasses++;
+		doprintfmt(pr, fmt, ap);
+		return;
+	}
+
+	fmtcache.busy = 1;
+	fc = &fmtcache.entries[((uintptr_t) fmt * 2654435761U >> 16)
+			       & (FMTCACHE_SIZE - 1)];
+	if (fc->fc_fmt == fmt)
+		fmtcache.hits++;
+	else {
+		fmtcache.misses++;
+		fc->fc_fmt = fmt;
+		fc->fc_nops = fmtcompile(fmt, fc->fc_ops, FMTCACHE_MAXOPS);
 	}
+	if (fc->fc_nops >= 0)
+		fmtrun(pr, fmt, fc->fc_ops, fc->fc_nops, ap);
+	else
+		doprintfmt(pr, fmt, ap);
+	fmtcache.busy = 0;
+}
+
+// Cache compiled formats that lie in [lo, hi), which must not change:
+// e.g., the read-only data holding string constants.
+void
+printfmt_cache_init(const char *lo, const char *hi)
+{
+	memset(&fmtcache, 0, sizeof(fmtcache));
+	fmtcache.lo = lo;
+	fmtcache.hi = hi;
+	fmtcache.enabled = 1;
+}
+
+// Turn the format cache on or off, returning whether it was on.
+int
+printfmt_cache_enable(int on)
+{
+	int was = fmtcache.enabled;
+
+	fmtcache.enabled = on;
+	return was;
+}
+
+void
+printfmt_cache_stats(unsigned *hits, unsigned *misses, unsigned *bypasses)
+{
+	*hits = fmtcache.hits;
+	*misses = fmtcache.misses;
+	*bypasses = fmtcache.bypasses;
+}
+
+
+// Main function to format and print a string.
+void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
+
+void
+vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+{
+	struct printer pr = { putch, NULL, putdat };
+
+	fmtprint(&pr, fmt, ap);
+}
+
+// Like vprintfmt, but output goes to putbuf a run of characters at a
+// time: whole numbers, strings, and the text between %-escapes.
+void
+vprintfmt_bulk(void (*putbuf)(const char*, int, void*), void *putdat,
+	       const char *fmt, va_list ap)
+{
+	struct printer pr = { NULL, putbuf, putdat };
+
+	fmtprint(&pr, fmt, ap);
 }
 
 void
@@ -260,11 +605,13 @@ struct sprintbuf {
 };
 
 static void
-sprintputch(int ch, struct sprintbuf *b)
+sprintputbuf(const char *s, int n, struct sprintbuf *b)
 {
-	b->cnt++;
-	if (b->buf < b->ebuf)
-		*b->buf++ = ch;
+	int k = MIN(n, b->ebuf - b->buf);
+
+	memcpy(b->buf, s, k);
+	b->buf += k;
+	b->cnt += n;
 }
 
 int
@@ -276,7 +623,7 @@ vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 		return -E_INVAL;
 
 	// print the string to the buffer
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	vprintfmt_bulk((void*)sprintputbuf, &b, fmt, ap);
 
 	// null terminate the buffer
 	*b.buf = '\0';